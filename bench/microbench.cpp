@@ -0,0 +1,288 @@
+// Microbenchmarks of the CPU stages every frame passes through after readback and of loading PLY files,
+// without OpenGL and Python. Every case is repeated for at least MIN_SECONDS and the fastest repetition is
+// reported, per pixel or point and as throughput of the input bytes.
+//
+//     microbench [filter] [--points N]
+//
+// Only cases whose name contains filter run. The PLY file is written to the temporary directory once and
+// read from the page cache afterwards, so the numbers do not depend on the disk.
+
+#include <tinyply.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "framepool.h"
+#include "lodepng.h"
+#include "simd.h"
+#include "stagetimes.h"
+#include "utils.h"
+
+namespace fs = std::experimental::filesystem;
+
+const double MIN_SECONDS = 0.5;
+const int MIN_REPETITIONS = 5;
+
+// Same as the renderer
+const float NEAR = 0.01f;
+const float FAR = 12.0f;
+const float DEPTH_SCALE = 1000.0f;
+
+struct Resolution
+{
+    int width, height;
+};
+
+const Resolution RESOLUTIONS[] = {{640, 480}, {1280, 720}, {1920, 1080}};
+const SimdLevel LEVELS[] = {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512};
+
+static std::string filter;
+
+// Deterministic noise, the images should not compress better than rendered ones
+static uint32_t hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Smooth gradients with a little noise and a background in the top quarter, starting with the bottom row
+// like the images read back from OpenGL
+static std::vector<unsigned char> colorImage(int width, int height)
+{
+    std::vector<unsigned char> image(size_t(width) * height * 3);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            unsigned char *pixel = &image[(size_t(y) * width + x) * 3];
+            if (y >= height * 3 / 4)
+            {
+                pixel[0] = pixel[1] = pixel[2] = 0;
+                continue;
+            }
+            const uint32_t noise = hash(uint32_t(y) * width + x) & 7;
+            pixel[0] = static_cast<unsigned char>(x * 200 / width + noise);
+            pixel[1] = static_cast<unsigned char>(y * 200 / height + noise);
+            pixel[2] = static_cast<unsigned char>(((x / 32 + y / 32) & 1) * 100 + noise);
+        }
+    }
+    return image;
+}
+
+// Window depths of a slanted plane between 0.5 and 5 m and of the background
+static std::vector<float> depthImage(int width, int height)
+{
+    std::vector<float> depth(size_t(width) * height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (y >= height * 3 / 4)
+            {
+                depth[size_t(y) * width + x] = 1.0f;
+                continue;
+            }
+            const float z = 0.5f + 4.5f * (float(x) / width) * (1.0f - float(y) / height);
+            const float ndc = (FAR + NEAR) / (FAR - NEAR) - 2.0f * FAR * NEAR / ((FAR - NEAR) * z);
+            depth[size_t(y) * width + x] = 0.5f * ndc + 0.5f;
+        }
+    }
+    return depth;
+}
+
+template <typename F>
+static double fastest(F &&run)
+{
+    double best = std::numeric_limits<double>::max();
+    const auto start = std::chrono::steady_clock::now();
+    for (int repetition = 0; repetition < MIN_REPETITIONS || secondsSince(start) < MIN_SECONDS; repetition++)
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, secondsSince(t0));
+    }
+    return best;
+}
+
+static bool selected(const std::string &name)
+{
+    return name.find(filter) != std::string::npos;
+}
+
+static void report(const std::string &name, const std::string &size, double seconds, size_t elements, const char *unit,
+                   size_t bytes)
+{
+    std::printf("%-28s %-16s %10.3f ns/%-5s %10.1f MB/s\n", name.c_str(), size.c_str(), 1e9 * seconds / elements, unit,
+                bytes * 1e-6 / seconds);
+    std::fflush(stdout);
+}
+
+static size_t encode(const unsigned char *image, int width, int height, LodePNGColorType colorType, unsigned bitDepth)
+{
+    EncoderArenaScope scope;
+    unsigned char *png = nullptr;
+    size_t pngSize = 0;
+    const unsigned error = lodepng_encode_memory(&png, &pngSize, image, width, height, colorType, bitDepth);
+    lodepng_free(png);
+    if (error)
+        throw std::runtime_error(std::string("Could not encode: ") + lodepng_error_text(error));
+    return pngSize;
+}
+
+static void imageBenchmarks(int width, int height)
+{
+    const size_t pixels = size_t(width) * height;
+    const std::string size = std::to_string(width) + "x" + std::to_string(height);
+    const auto color = colorImage(width, height);
+    const auto depth = depthImage(width, height);
+    std::vector<unsigned char> flipped(pixels * 3);
+    std::vector<unsigned char> packed(pixels * 2);
+
+    if (selected("flip"))
+    {
+        const double seconds = fastest([&]() { flipRows(color.data(), flipped.data(), size_t(width) * 3, height); });
+        report("flip", size, seconds, pixels, "pixel", pixels * 3);
+    }
+    flipRows(color.data(), flipped.data(), size_t(width) * 3, height);
+
+    const SimdLevel initial = simdLevel();
+    for (SimdLevel level : LEVELS)
+    {
+        // unsupported levels fall back to a lower one
+        if (setSimdLevel(level) != level)
+            continue;
+        const std::string suffix = " " + simdLevelName(level);
+        if (selected("packDepth" + suffix))
+        {
+            const double seconds = fastest([&]() { packDepth(depth.data(), packed.data(), width, height, NEAR, FAR, DEPTH_SCALE); });
+            report("packDepth" + suffix, size, seconds, pixels, "pixel", pixels * 4);
+        }
+        packDepth(depth.data(), packed.data(), width, height, NEAR, FAR, DEPTH_SCALE);
+        if (selected("encode color" + suffix))
+        {
+            const double seconds = fastest([&]() { encode(flipped.data(), width, height, LCT_RGB, 8U); });
+            report("encode color" + suffix, size, seconds, pixels, "pixel", pixels * 3);
+        }
+        if (selected("encode depth" + suffix))
+        {
+            const double seconds = fastest([&]() { encode(packed.data(), width, height, LCT_GREY, 16U); });
+            report("encode depth" + suffix, size, seconds, pixels, "pixel", pixels * 2);
+        }
+    }
+    setSimdLevel(initial);
+}
+
+// Points on a plane with the attributes of the synthetic scenes of tests/synthetic.py
+static void writePly(const std::string &path, size_t numPoints)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not write " + path);
+    file << "ply\nformat binary_little_endian 1.0\nelement vertex " << numPoints << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "property float nx\nproperty float ny\nproperty float nz\n"
+         << "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n";
+    std::vector<char> vertex(6 * sizeof(float) + 3);
+    for (size_t i = 0; i < numPoints; i++)
+    {
+        const uint32_t h = hash(static_cast<uint32_t>(i));
+        const float attributes[6] = {float(h & 0xffff) / 0xffff, float(h >> 16) / 0xffff, -1.0f, 0.0f, 0.0f, 1.0f};
+        std::memcpy(vertex.data(), attributes, sizeof(attributes));
+        vertex[24] = static_cast<char>(h);
+        vertex[25] = static_cast<char>(h >> 8);
+        vertex[26] = static_cast<char>(h >> 16);
+        file.write(vertex.data(), vertex.size());
+    }
+}
+
+// Same requests as readPly
+static size_t parsePly(const std::vector<uint8_t> &bytes)
+{
+    memory_stream stream(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    tinyply::PlyFile file;
+    file.parse_header(stream);
+    auto position = file.request_properties_from_element("vertex", {"x", "y", "z"});
+    auto normal = file.request_properties_from_element("vertex", {"nx", "ny", "nz"});
+    auto color = file.request_properties_from_element("vertex", {"red", "green", "blue"});
+    file.read(stream);
+    return position->count;
+}
+
+static void plyBenchmarks(size_t numPoints)
+{
+    if (!selected("read_file_binary") && !selected("parse ply"))
+        return;
+    const std::string path = (fs::temp_directory_path() / "splat_renderer_microbench.ply").string();
+    writePly(path, numPoints);
+    try
+    {
+        const std::string size = std::to_string(numPoints) + " points";
+        auto bytes = read_file_binary(path);
+        if (selected("read_file_binary"))
+        {
+            const double seconds = fastest([&]() { bytes = read_file_binary(path); });
+            report("read_file_binary", size, seconds, numPoints, "point", bytes.size());
+        }
+        if (selected("parse ply"))
+        {
+            if (parsePly(bytes) != numPoints)
+                throw std::runtime_error("Parsed the wrong number of points");
+            const double seconds = fastest([&]() { parsePly(bytes); });
+            report("parse ply", size, seconds, numPoints, "point", bytes.size());
+        }
+    }
+    catch (...)
+    {
+        fs::remove(path);
+        throw;
+    }
+    fs::remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    size_t numPoints = 1000000;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--points" && i + 1 < argc)
+            numPoints = std::stoull(argv[++i]);
+        else if (arg == "-h" || arg == "--help")
+        {
+            std::cout << "usage: " << argv[0] << " [filter] [--points N]" << std::endl;
+            return 0;
+        }
+        else
+            filter = arg;
+    }
+
+    try
+    {
+        std::cout << "SIMD level: " << simdLevelName(simdLevel()) << std::endl;
+        for (const auto &resolution : RESOLUTIONS)
+        {
+            imageBenchmarks(resolution.width, resolution.height);
+        }
+        plyBenchmarks(numPoints);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
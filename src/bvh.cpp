@@ -0,0 +1,419 @@
+#include "bvh.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <tuple>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BVH_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// Leaves hold at most this many splats unless the surface area heuristic prefers larger ones
+const uint32_t MAX_LEAF_SIZE = 4;
+// Nodes this deep stay leaves, the traversal stack holds at most one node per level and the two children
+const uint32_t MAX_DEPTH = 63;
+const int SAH_BINS = 16;
+// Edge length of the pixel blocks the frame is split into for the workers, in pixels
+const int RAYCAST_TILE_SIZE = 16;
+const uint32_t NO_HIT = 0xffffffffu;
+
+struct Bounds
+{
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    void grow(const Bounds &other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    void grow(const glm::vec3 &point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    float area() const
+    {
+        const glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+};
+
+SplatBVH buildBVH(const PointCloud &pcl)
+{
+    SplatBVH bvh;
+    for (size_t i = 0; i < pcl.size; i++)
+    {
+        if (pcl.sourceIndex.empty() || pcl.sourceIndex[i] != NO_SOURCE_INDEX)
+            bvh.indices.push_back(static_cast<uint32_t>(i));
+    }
+
+    // exact bounds of the discs, a disc extends r * sqrt(1 - n_i^2) along axis i
+    std::vector<Bounds> boxes(pcl.size);
+    std::vector<glm::vec3> centers(pcl.size);
+    for (auto i : bvh.indices)
+    {
+        const glm::vec3 center(pcl.position[i].x, pcl.position[i].y, pcl.position[i].z);
+        glm::vec3 normal(pcl.normal[i].x, pcl.normal[i].y, pcl.normal[i].z);
+        const float length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : glm::vec3(0.0f);
+        const glm::vec3 extent = pcl.radius[i] * glm::sqrt(glm::max(glm::vec3(1.0f) - normal * normal, glm::vec3(0.0f)));
+        boxes[i].min = center - extent;
+        boxes[i].max = center + extent;
+        centers[i] = center;
+    }
+
+    bvh.nodes.reserve(2 * bvh.indices.size() / MAX_LEAF_SIZE + 1);
+    bvh.nodes.push_back(BVHNode());
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>> stack{{0, 0, static_cast<uint32_t>(bvh.indices.size()), 0}};
+    while (!stack.empty())
+    {
+        uint32_t node, begin, end, depth;
+        std::tie(node, begin, end, depth) = stack.back();
+        stack.pop_back();
+
+        Bounds bounds;
+        Bounds centroidBounds;
+        for (uint32_t k = begin; k < end; k++)
+        {
+            bounds.grow(boxes[bvh.indices[k]]);
+            centroidBounds.grow(centers[bvh.indices[k]]);
+        }
+        bvh.nodes[node].min = bounds.min;
+        bvh.nodes[node].max = bounds.max;
+        bvh.nodes[node].offset = begin;
+        bvh.nodes[node].count = end - begin;
+        const uint32_t count = end - begin;
+        if (count <= MAX_LEAF_SIZE || depth == MAX_DEPTH)
+            continue;
+
+        // cheapest split between the bins of the centroids along any axis
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestSplit = 0;
+        const glm::vec3 centroidExtent = centroidBounds.max - centroidBounds.min;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (centroidExtent[axis] <= 0.0f)
+                continue;
+            std::array<Bounds, SAH_BINS> bins;
+            std::array<uint32_t, SAH_BINS> binCounts{};
+            const float scale = SAH_BINS / centroidExtent[axis];
+            for (uint32_t k = begin; k < end; k++)
+            {
+                const auto i = bvh.indices[k];
+                const int bin = std::min(static_cast<int>((centers[i][axis] - centroidBounds.min[axis]) * scale), SAH_BINS - 1);
+                bins[bin].grow(boxes[i]);
+                binCounts[bin]++;
+            }
+            std::array<float, SAH_BINS> rightCost;
+            Bounds right;
+            uint32_t rightCount = 0;
+            for (int bin = SAH_BINS - 1; bin > 0; bin--)
+            {
+                right.grow(bins[bin]);
+                rightCount += binCounts[bin];
+                rightCost[bin] = right.area() * rightCount;
+            }
+            Bounds left;
+            uint32_t leftCount = 0;
+            for (int split = 1; split < SAH_BINS; split++)
+            {
+                left.grow(bins[split - 1]);
+                leftCount += binCounts[split - 1];
+                const float cost = left.area() * leftCount + rightCost[split];
+                if (leftCount > 0 && leftCount < count && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (bestAxis < 0)
+        {
+            // all centroids coincide
+            middle = begin + count / 2;
+        }
+        else
+        {
+            if (bestCost >= bounds.area() * count && count <= 4 * MAX_LEAF_SIZE)
+                continue;
+            const float scale = SAH_BINS / centroidExtent[bestAxis];
+            const float minimum = centroidBounds.min[bestAxis];
+            middle = static_cast<uint32_t>(std::partition(bvh.indices.begin() + begin, bvh.indices.begin() + end, [&](uint32_t i) {
+                return std::min(static_cast<int>((centers[i][bestAxis] - minimum) * scale), SAH_BINS - 1) < bestSplit;
+            }) - bvh.indices.begin());
+        }
+
+        const auto children = static_cast<uint32_t>(bvh.nodes.size());
+        bvh.nodes[node].offset = children;
+        bvh.nodes[node].count = 0;
+        bvh.nodes.push_back(BVHNode());
+        bvh.nodes.push_back(BVHNode());
+        stack.emplace_back(children, begin, middle, depth + 1);
+        stack.emplace_back(children + 1, middle, end, depth + 1);
+    }
+
+    std::cout << "\tBuilt BVH with " << bvh.nodes.size() << " nodes over " << bvh.indices.size() << " splats" << std::endl;
+    return bvh;
+}
+
+// Closest hits of up to four rays from the camera, t = 1 is on the near plane
+struct RayPacket
+{
+    float x[4], y[4], z[4];  // world space directions
+    float best[4];  // closest hit so far
+    uint32_t hit[4];
+    int active;  // mask of rays inside the image
+};
+
+static void tracePacket(const PointCloud &pcl, const SplatBVH &bvh, const glm::vec3 &origin, bool backfaceCulling,
+                        RayPacket &packet)
+{
+    std::array<uint32_t, MAX_DEPTH + 1> stack;
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+#ifdef BVH_USE_SSE
+    // all rays of the packet are tested against a node at once
+    const __m128 ox = _mm_set1_ps(origin.x);
+    const __m128 oy = _mm_set1_ps(origin.y);
+    const __m128 oz = _mm_set1_ps(origin.z);
+    const __m128 dx = _mm_loadu_ps(packet.x);
+    const __m128 dy = _mm_loadu_ps(packet.y);
+    const __m128 dz = _mm_loadu_ps(packet.z);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 invX = _mm_div_ps(one, dx);
+    const __m128 invY = _mm_div_ps(one, dy);
+    const __m128 invZ = _mm_div_ps(one, dz);
+    __m128 best = _mm_loadu_ps(packet.best);
+
+    // entry distances of the rays that hit the node, returns the mask of these rays
+    auto intersectNode = [&](const BVHNode &node, float &entry) {
+        const __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), ox), invX);
+        const __m128 x2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), ox), invX);
+        const __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), oy), invY);
+        const __m128 y2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), oy), invY);
+        const __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), oz), invZ);
+        const __m128 z2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), oz), invZ);
+        const __m128 near = _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_max_ps(_mm_min_ps(z1, z2), one));
+        const __m128 far = _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_min_ps(_mm_max_ps(z1, z2), best));
+        const int mask = _mm_movemask_ps(_mm_cmple_ps(near, far)) & packet.active;
+        alignas(16) float nears[4];
+        _mm_store_ps(nears, near);
+        entry = std::numeric_limits<float>::max();
+        for (int k = 0; k < 4; k++)
+        {
+            if (mask & (1 << k))
+                entry = std::min(entry, nears[k]);
+        }
+        return mask;
+    };
+
+    float entry;
+    if (!intersectNode(bvh.nodes[0], entry))
+        return;
+    alignas(16) float ts[4];
+    while (stackSize > 0)
+    {
+        const auto &node = bvh.nodes[stack[--stackSize]];
+        if (node.count == 0)
+        {
+            // visit the closer child first
+            float leftEntry, rightEntry;
+            const int left = intersectNode(bvh.nodes[node.offset], leftEntry);
+            const int right = intersectNode(bvh.nodes[node.offset + 1], rightEntry);
+            if (left && right)
+            {
+                const bool leftFirst = leftEntry <= rightEntry;
+                stack[stackSize++] = leftFirst ? node.offset + 1 : node.offset;
+                stack[stackSize++] = leftFirst ? node.offset : node.offset + 1;
+            }
+            else if (left || right)
+            {
+                stack[stackSize++] = left ? node.offset : node.offset + 1;
+            }
+            continue;
+        }
+
+        for (uint32_t k = node.offset; k < node.offset + node.count; k++)
+        {
+            const auto i = bvh.indices[k];
+            const glm::vec3 center(pcl.position[i].x, pcl.position[i].y, pcl.position[i].z);
+            const glm::vec3 normal(pcl.normal[i].x, pcl.normal[i].y, pcl.normal[i].z);
+            const glm::vec3 toCenter = center - origin;
+            // the camera sits behind the plane of the disc
+            if (backfaceCulling && glm::dot(normal, toCenter) > 0.0f)
+                continue;
+            const __m128 dn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_set1_ps(normal.x)), _mm_mul_ps(dy, _mm_set1_ps(normal.y))),
+                                         _mm_mul_ps(dz, _mm_set1_ps(normal.z)));
+            const __m128 t = _mm_div_ps(_mm_set1_ps(glm::dot(toCenter, normal)), dn);
+            const __m128 offsetX = _mm_sub_ps(_mm_mul_ps(t, dx), _mm_set1_ps(toCenter.x));
+            const __m128 offsetY = _mm_sub_ps(_mm_mul_ps(t, dy), _mm_set1_ps(toCenter.y));
+            const __m128 offsetZ = _mm_sub_ps(_mm_mul_ps(t, dz), _mm_set1_ps(toCenter.z));
+            const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(offsetX, offsetX), _mm_mul_ps(offsetY, offsetY)),
+                                               _mm_mul_ps(offsetZ, offsetZ));
+            __m128 closer = _mm_and_ps(_mm_cmple_ps(distance, _mm_set1_ps(pcl.radius[i] * pcl.radius[i])),
+                                       _mm_and_ps(_mm_cmpge_ps(t, one), _mm_cmplt_ps(t, best)));
+            const int mask = _mm_movemask_ps(closer) & packet.active;
+            if (mask == 0)
+                continue;
+            best = _mm_or_ps(_mm_and_ps(closer, t), _mm_andnot_ps(closer, best));
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (mask & (1 << lane))
+                    packet.hit[lane] = i;
+            }
+        }
+    }
+    _mm_store_ps(ts, best);
+    std::copy(ts, ts + 4, packet.best);
+#else
+    // without SIMD every ray of the packet is traced on its own
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (!(packet.active & (1 << lane)))
+            continue;
+        const glm::vec3 direction(packet.x[lane], packet.y[lane], packet.z[lane]);
+        const glm::vec3 inverse = 1.0f / direction;
+        auto intersectNode = [&](const BVHNode &node, float &entry) {
+            const glm::vec3 t1 = (node.min - origin) * inverse;
+            const glm::vec3 t2 = (node.max - origin) * inverse;
+            const glm::vec3 lower = glm::min(t1, t2);
+            const glm::vec3 upper = glm::max(t1, t2);
+            entry = std::max(std::max(lower.x, lower.y), std::max(lower.z, 1.0f));
+            return entry <= std::min(std::min(upper.x, upper.y), std::min(upper.z, packet.best[lane]));
+        };
+        float entry;
+        stackSize = 0;
+        if (intersectNode(bvh.nodes[0], entry))
+            stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const auto &node = bvh.nodes[stack[--stackSize]];
+            if (node.count == 0)
+            {
+                float leftEntry, rightEntry;
+                const bool left = intersectNode(bvh.nodes[node.offset], leftEntry);
+                const bool right = intersectNode(bvh.nodes[node.offset + 1], rightEntry);
+                if (left && right)
+                {
+                    const bool leftFirst = leftEntry <= rightEntry;
+                    stack[stackSize++] = leftFirst ? node.offset + 1 : node.offset;
+                    stack[stackSize++] = leftFirst ? node.offset : node.offset + 1;
+                }
+                else if (left || right)
+                {
+                    stack[stackSize++] = left ? node.offset : node.offset + 1;
+                }
+                continue;
+            }
+            for (uint32_t k = node.offset; k < node.offset + node.count; k++)
+            {
+                const auto i = bvh.indices[k];
+                const glm::vec3 center(pcl.position[i].x, pcl.position[i].y, pcl.position[i].z);
+                const glm::vec3 normal(pcl.normal[i].x, pcl.normal[i].y, pcl.normal[i].z);
+                const glm::vec3 toCenter = center - origin;
+                if (backfaceCulling && glm::dot(normal, toCenter) > 0.0f)
+                    continue;
+                const float t = glm::dot(toCenter, normal) / glm::dot(direction, normal);
+                const glm::vec3 offset = t * direction - toCenter;
+                if (glm::dot(offset, offset) <= pcl.radius[i] * pcl.radius[i] && t >= 1.0f && t < packet.best[lane])
+                {
+                    packet.best[lane] = t;
+                    packet.hit[lane] = i;
+                }
+            }
+        }
+    }
+#endif
+}
+
+size_t raycastSplats(const PointCloud &pcl, const SplatBVH &bvh, const glm::mat4 &view, const glm::mat4 &projection,
+                     int width, int height, bool backfaceCulling, unsigned char *color, float *depth)
+{
+    TRACE_ZONE("raycastSplats");
+    const auto inverseProjection = glm::inverse(projection);
+    const auto inverseView = glm::inverse(view);
+    const glm::vec3 origin(inverseView[3]);
+    const glm::mat3 rotation(inverseView);
+    // rays end at the far plane
+    const float near = projection[3][2] / (projection[2][2] - 1.0f);
+    const float far = projection[3][2] / (projection[2][2] + 1.0f);
+
+    std::vector<uint32_t> hits(static_cast<size_t>(width) * height, NO_HIT);
+    const int tilesX = (width + RAYCAST_TILE_SIZE - 1) / RAYCAST_TILE_SIZE;
+    const int tilesY = (height + RAYCAST_TILE_SIZE - 1) / RAYCAST_TILE_SIZE;
+    parallelForStealing(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile) {
+        const int tileX = static_cast<int>(tile % tilesX) * RAYCAST_TILE_SIZE;
+        const int tileY = static_cast<int>(tile / tilesX) * RAYCAST_TILE_SIZE;
+        // packets of 2x2 neighbouring pixels
+        for (int y = tileY; y < std::min(tileY + RAYCAST_TILE_SIZE, height); y += 2)
+        {
+            for (int x = tileX; x < std::min(tileX + RAYCAST_TILE_SIZE, width); x += 2)
+            {
+                RayPacket packet;
+                glm::vec3 viewRays[4];
+                packet.active = 0;
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    const int px = std::min(x + (lane & 1), width - 1);
+                    const int py = std::min(y + (lane >> 1), height - 1);
+                    if (x + (lane & 1) < width && y + (lane >> 1) < height)
+                        packet.active |= 1 << lane;
+                    const glm::vec2 ndc = 2.0f * (glm::vec2(px, py) + 0.5f) / glm::vec2(width, height) - 1.0f;
+                    const glm::vec4 onNear = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+                    viewRays[lane] = glm::vec3(onNear) / onNear.w;
+                    const glm::vec3 direction = rotation * viewRays[lane];
+                    packet.x[lane] = direction.x;
+                    packet.y[lane] = direction.y;
+                    packet.z[lane] = direction.z;
+                    packet.best[lane] = far / near;
+                    packet.hit[lane] = NO_HIT;
+                }
+
+                tracePacket(pcl, bvh, origin, backfaceCulling, packet);
+
+                for (int lane = 0; lane < 4; lane++)
+                {
+                    if (!(packet.active & (1 << lane)))
+                        continue;
+                    const size_t pixel = static_cast<size_t>(y + (lane >> 1)) * width + x + (lane & 1);
+                    float windowDepth = 1.0f;
+                    float viewDepth = 0.0f;
+                    if (packet.hit[lane] != NO_HIT)
+                    {
+                        const glm::vec3 position = packet.best[lane] * viewRays[lane];
+                        const glm::vec4 clip = projection * glm::vec4(position, 1.0f);
+                        windowDepth = 0.5f * clip.z / clip.w + 0.5f;
+                        viewDepth = position.z;
+                        if (windowDepth < 1.0f)
+                            hits[pixel] = packet.hit[lane];
+                        else
+                            windowDepth = 1.0f;
+                    }
+                    // same output as splat.frag
+                    const auto value = static_cast<unsigned char>(std::min(std::max(-viewDepth / 5.0f, 0.0f), 1.0f) * 255.0f + 0.5f);
+                    color[3 * pixel] = value;
+                    color[3 * pixel + 1] = value;
+                    color[3 * pixel + 2] = value;
+                    depth[pixel] = windowDepth;
+                }
+            }
+        }
+    });
+
+    std::sort(hits.begin(), hits.end());
+    const auto uniqueEnd = std::unique(hits.begin(), hits.end());
+    return (uniqueEnd - hits.begin()) - (std::binary_search(hits.begin(), uniqueEnd, NO_HIT) ? 1 : 0);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "pointcloud.h"
+
+// Node of a bounding volume hierarchy over splat discs. Inner nodes have count == 0 and their two
+// children at offset and offset + 1, leaves hold count splats starting at offset in the index array.
+struct BVHNode
+{
+    glm::vec3 min;
+    uint32_t offset;
+    glm::vec3 max;
+    uint32_t count;
+};
+
+struct SplatBVH
+{
+    std::vector<BVHNode> nodes;  // the root first
+    std::vector<uint32_t> indices;  // splats in the order of the leaves
+};
+
+// Builds a BVH over the original points of the point cloud (levels of detail are skipped) by
+// splitting along the binned surface area heuristic
+SplatBVH buildBVH(const PointCloud &pcl);
+
+// Casts the view rays through all pixel centers and shades the first disc every ray hits like the
+// standard method does. color and depth have the same layout as for rasterizeSplats. Returns the
+// number of different splats that were hit.
+size_t raycastSplats(const PointCloud &pcl, const SplatBVH &bvh, const glm::mat4 &view, const glm::mat4 &projection,
+                     int width, int height, bool backfaceCulling, unsigned char *color, float *depth);
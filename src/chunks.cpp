@@ -0,0 +1,442 @@
+#include "chunks.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CHUNKS_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// Upper bound for the number of grid cells, the chunk size is increased until the grid fits
+const size_t MAX_CHUNK_CELLS = size_t(1) << 22;
+
+// Culling is only split into several tasks for very large chunk counts
+const size_t CHUNKS_PER_TASK = 4096;
+
+// Bounding sphere and normal cone of the splats [cluster.first, cluster.first + cluster.count)
+static void boundCluster(const PointCloud &pcl, Cluster &cluster)
+{
+    glm::vec3 lower(std::numeric_limits<float>::max());
+    glm::vec3 upper(std::numeric_limits<float>::lowest());
+    glm::vec3 normalSum(0.0f);
+    bool validNormals = true;
+    for (size_t i = cluster.first; i < cluster.first + cluster.count; i++)
+    {
+        const auto &p = pcl.position[i];
+        const auto &n = pcl.normal[i];
+        lower = glm::min(lower, glm::vec3(p.x, p.y, p.z));
+        upper = glm::max(upper, glm::vec3(p.x, p.y, p.z));
+        const float length = glm::length(glm::vec3(n.x, n.y, n.z));
+        if (!(length > 0.0f) || !std::isfinite(length))
+            validNormals = false;
+        else
+            normalSum += glm::vec3(n.x, n.y, n.z) / length;
+    }
+
+    cluster.center = 0.5f * (lower + upper);
+    cluster.radius = 0.0f;
+    for (size_t i = cluster.first; i < cluster.first + cluster.count; i++)
+    {
+        const auto &p = pcl.position[i];
+        cluster.radius = std::max(cluster.radius, glm::distance(cluster.center, glm::vec3(p.x, p.y, p.z)) + pcl.radius[i]);
+    }
+
+    // a cone with a half angle of 90 degrees or more can never face away as a whole,
+    // a cosine of 0 and sine of 1 makes the culling test always fail
+    cluster.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    cluster.coneCos = 0.0f;
+    cluster.coneSin = 1.0f;
+    if (!validNormals || glm::length(normalSum) < 1e-6f)
+        return;
+
+    cluster.coneAxis = glm::normalize(normalSum);
+    float minCos = 1.0f;
+    for (size_t i = cluster.first; i < cluster.first + cluster.count; i++)
+    {
+        const auto &n = pcl.normal[i];
+        minCos = std::min(minCos, glm::dot(cluster.coneAxis, glm::normalize(glm::vec3(n.x, n.y, n.z))));
+    }
+    if (minCos > 0.0f)
+    {
+        cluster.coneCos = minCos;
+        cluster.coneSin = std::sqrt(std::max(0.0f, 1.0f - minCos * minCos));
+    }
+}
+
+ChunkIndex buildChunkIndex(PointCloud &pcl, float chunkSize)
+{
+    if (chunkSize <= 0.0f)
+    {
+        throw std::runtime_error("Chunk size has to be positive");
+    }
+    if (pcl.size > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Point cloud has too many points for the chunk index");
+    }
+
+    ChunkIndex index;
+    if (pcl.size == 0)
+    {
+        index.chunkSize = chunkSize;
+        return index;
+    }
+
+    glm::vec3 lower(std::numeric_limits<float>::max());
+    glm::vec3 upper(std::numeric_limits<float>::lowest());
+    for (const auto &p : pcl.position)
+    {
+        lower = glm::min(lower, glm::vec3(p.x, p.y, p.z));
+        upper = glm::max(upper, glm::vec3(p.x, p.y, p.z));
+    }
+
+    glm::uvec3 dims;
+    while (true)
+    {
+        dims = glm::uvec3((upper - lower) / chunkSize) + 1u;
+        if (size_t(dims.x) * dims.y * dims.z <= MAX_CHUNK_CELLS)
+            break;
+        chunkSize *= 2.0f;
+    }
+    index.chunkSize = chunkSize;
+
+    // grid cell of every point
+    std::vector<uint32_t> cells(pcl.size);
+    {
+        const size_t numTasks = ThreadPool::instance().concurrency();
+        const size_t perTask = (pcl.size + numTasks - 1) / numTasks;
+        std::vector<std::future<void>> tasks;
+        for (size_t begin = 0; begin < pcl.size; begin += perTask)
+        {
+            const size_t end = std::min(pcl.size, begin + perTask);
+            tasks.push_back(ThreadPool::instance().submit([&, begin, end]() {
+                for (size_t i = begin; i < end; i++)
+                {
+                    const auto &p = pcl.position[i];
+                    auto cell = glm::min(glm::uvec3((glm::vec3(p.x, p.y, p.z) - lower) / chunkSize), dims - 1u);
+                    cells[i] = (cell.z * dims.y + cell.y) * dims.x + cell.x;
+                }
+            }));
+        }
+        for (auto &task : tasks)
+        {
+            ThreadPool::instance().wait(task);
+        }
+    }
+
+    // counting sort by cell, stable so the original order is kept inside a chunk
+    std::vector<uint32_t> offsets(size_t(dims.x) * dims.y * dims.z + 1, 0);
+    for (auto cell : cells)
+    {
+        offsets[cell + 1]++;
+    }
+    for (size_t c = 1; c < offsets.size(); c++)
+    {
+        offsets[c] += offsets[c - 1];
+    }
+    std::vector<uint32_t> order(pcl.size);
+    {
+        std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < pcl.size; i++)
+        {
+            order[next[cells[i]]++] = static_cast<uint32_t>(i);
+        }
+    }
+    cells.clear();
+    cells.shrink_to_fit();
+
+    reorder(pcl, order);
+
+    for (size_t c = 0; c + 1 < offsets.size(); c++)
+    {
+        if (offsets[c] == offsets[c + 1])
+            continue;
+
+        ChunkLevel level;
+        level.first = offsets[c];
+        level.count = offsets[c + 1] - offsets[c];
+        level.splatRadius = 0.0f;
+        Chunk chunk;
+        chunk.min = glm::vec3(std::numeric_limits<float>::max());
+        chunk.max = glm::vec3(std::numeric_limits<float>::lowest());
+        for (size_t i = level.first; i < level.first + level.count; i++)
+        {
+            const auto &p = pcl.position[i];
+            const float r = pcl.radius[i];
+            chunk.min = glm::min(chunk.min, glm::vec3(p.x - r, p.y - r, p.z - r));
+            chunk.max = glm::max(chunk.max, glm::vec3(p.x + r, p.y + r, p.z + r));
+            level.splatRadius = std::max(level.splatRadius, r);
+        }
+        chunk.levels.push_back(level);
+        index.chunks.push_back(chunk);
+    }
+
+    buildClusters(pcl, index);
+
+    std::cout << "\tPartitioned " << pcl.size << " points into " << index.chunks.size() << " chunks of "
+              << chunkSize << "m and " << index.clusters.size() << " clusters" << std::endl;
+    return index;
+}
+
+void buildClusters(const PointCloud &pcl, ChunkIndex &index)
+{
+    index.clusters.clear();
+    for (auto &chunk : index.chunks)
+    {
+        for (auto &level : chunk.levels)
+        {
+            level.firstCluster = index.clusters.size();
+            level.numClusters = (level.count + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+            for (size_t k = 0; k < level.numClusters; k++)
+            {
+                Cluster cluster;
+                cluster.first = level.first + k * CLUSTER_SIZE;
+                cluster.count = std::min(CLUSTER_SIZE, level.first + level.count - cluster.first);
+                index.clusters.push_back(cluster);
+            }
+        }
+    }
+
+    {
+        const size_t numTasks = ThreadPool::instance().concurrency();
+        const size_t perTask = (index.clusters.size() + numTasks - 1) / numTasks;
+        std::vector<std::future<void>> tasks;
+        for (size_t begin = 0; begin < index.clusters.size(); begin += perTask)
+        {
+            const size_t end = std::min(index.clusters.size(), begin + perTask);
+            tasks.push_back(ThreadPool::instance().submit([&, begin, end]() {
+                for (size_t c = begin; c < end; c++)
+                {
+                    boundCluster(pcl, index.clusters[c]);
+                }
+            }));
+        }
+        for (auto &task : tasks)
+        {
+            ThreadPool::instance().wait(task);
+        }
+    }
+
+    const size_t padded = (index.chunks.size() + 3) / 4 * 4;
+    for (auto *bounds : {&index.minX, &index.minY, &index.minZ, &index.maxX, &index.maxY, &index.maxZ})
+    {
+        bounds->assign(padded, 0.0f);
+    }
+    for (size_t c = 0; c < index.chunks.size(); c++)
+    {
+        index.minX[c] = index.chunks[c].min.x;
+        index.minY[c] = index.chunks[c].min.y;
+        index.minZ[c] = index.chunks[c].min.z;
+        index.maxX[c] = index.chunks[c].max.x;
+        index.maxY[c] = index.chunks[c].max.y;
+        index.maxZ[c] = index.chunks[c].max.z;
+    }
+
+    const size_t paddedClusters = index.clusters.size() + 3;
+    for (auto *values : {&index.centerX, &index.centerY, &index.centerZ, &index.radius,
+                         &index.axisX, &index.axisY, &index.axisZ, &index.coneCos, &index.coneSin})
+    {
+        values->assign(paddedClusters, 0.0f);
+    }
+    for (size_t c = 0; c < index.clusters.size(); c++)
+    {
+        const auto &cluster = index.clusters[c];
+        index.centerX[c] = cluster.center.x;
+        index.centerY[c] = cluster.center.y;
+        index.centerZ[c] = cluster.center.z;
+        index.radius[c] = cluster.radius;
+        index.axisX[c] = cluster.coneAxis.x;
+        index.axisY[c] = cluster.coneAxis.y;
+        index.axisZ[c] = cluster.coneAxis.z;
+        index.coneCos[c] = cluster.coneCos;
+        index.coneSin[c] = cluster.coneSin;
+    }
+}
+
+// Tests the chunks [begin, end) against the planes, begin has to be a multiple of 4
+static void cullChunkRange(const ChunkIndex &index, const std::array<glm::vec4, 6> &planes, float nearSlack,
+                           size_t begin, size_t end, std::vector<size_t> &visible)
+{
+#ifdef CHUNKS_USE_SSE
+    for (size_t c = begin; c < end; c += 4)
+    {
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++)
+        {
+            const auto &plane = planes[p];
+            // the box corner furthest along the plane normal decides if the box is outside
+            const __m128 x = _mm_loadu_ps(plane.x >= 0.0f ? &index.maxX[c] : &index.minX[c]);
+            const __m128 y = _mm_loadu_ps(plane.y >= 0.0f ? &index.maxY[c] : &index.minY[c]);
+            const __m128 z = _mm_loadu_ps(plane.z >= 0.0f ? &index.maxZ[c] : &index.minZ[c]);
+            __m128 distance = _mm_set1_ps(plane.w + (p == 4 ? nearSlack : 0.0f));
+            distance = _mm_add_ps(distance, _mm_mul_ps(x, _mm_set1_ps(plane.x)));
+            distance = _mm_add_ps(distance, _mm_mul_ps(y, _mm_set1_ps(plane.y)));
+            distance = _mm_add_ps(distance, _mm_mul_ps(z, _mm_set1_ps(plane.z)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+        }
+        const int mask = _mm_movemask_ps(outside);
+        for (size_t k = 0; k < 4 && c + k < end; k++)
+        {
+            if (!(mask & (1 << k)))
+                visible.push_back(c + k);
+        }
+    }
+#else
+    for (size_t c = begin; c < end; c++)
+    {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            const auto &plane = planes[p];
+            const float x = plane.x >= 0.0f ? index.maxX[c] : index.minX[c];
+            const float y = plane.y >= 0.0f ? index.maxY[c] : index.minY[c];
+            const float z = plane.z >= 0.0f ? index.maxZ[c] : index.minZ[c];
+            inside = plane.x * x + plane.y * y + plane.z * z + plane.w + (p == 4 ? nearSlack : 0.0f) >= 0.0f;
+        }
+        if (inside)
+            visible.push_back(c);
+    }
+#endif
+}
+
+std::vector<size_t> cullChunks(const ChunkIndex &index, const std::array<glm::vec4, 6> &planes, float nearSlack)
+{
+    const size_t numChunks = index.chunks.size();
+    std::vector<size_t> visible;
+    if (numChunks <= CHUNKS_PER_TASK)
+    {
+        cullChunkRange(index, planes, nearSlack, 0, numChunks, visible);
+        return visible;
+    }
+
+    std::vector<std::future<std::vector<size_t>>> tasks;
+    for (size_t begin = 0; begin < numChunks; begin += CHUNKS_PER_TASK)
+    {
+        const size_t end = std::min(numChunks, begin + CHUNKS_PER_TASK);
+        tasks.push_back(ThreadPool::instance().submit([&, begin, end]() {
+            std::vector<size_t> visibleInTask;
+            cullChunkRange(index, planes, nearSlack, begin, end, visibleInTask);
+            return visibleInTask;
+        }));
+    }
+    for (auto &task : tasks)
+    {
+        auto visibleInTask = ThreadPool::instance().wait(task);
+        visible.insert(visible.end(), visibleInTask.begin(), visibleInTask.end());
+    }
+    return visible;
+}
+
+// Tests the clusters [begin, end) against the planes and the camera position
+static void cullClusterRange(const ChunkIndex &index, const std::array<glm::vec4, 6> &planes, float nearSlack,
+                             const glm::vec3 &cameraPosition, bool backfaceCulling,
+                             size_t begin, size_t end, std::vector<size_t> &visible)
+{
+    // All splats lie in the bounding sphere (center s, radius r) and their normals within the angle t
+    // of the cone axis a. With d = s - camera, every splat faces away from the camera if
+    //     dot(a, d) * cos(t) - |cross(a, d)| * sin(t) > r
+#ifdef CHUNKS_USE_SSE
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t c = begin; c < end; c += 4)
+    {
+        const __m128 cx = _mm_loadu_ps(&index.centerX[c]);
+        const __m128 cy = _mm_loadu_ps(&index.centerY[c]);
+        const __m128 cz = _mm_loadu_ps(&index.centerZ[c]);
+        const __m128 r = _mm_loadu_ps(&index.radius[c]);
+        const __m128 negR = _mm_sub_ps(zero, r);
+
+        __m128 culled = zero;
+        for (int p = 0; p < 6; p++)
+        {
+            const auto &plane = planes[p];
+            __m128 distance = _mm_set1_ps(plane.w + (p == 4 ? nearSlack : 0.0f));
+            distance = _mm_add_ps(distance, _mm_mul_ps(cx, _mm_set1_ps(plane.x)));
+            distance = _mm_add_ps(distance, _mm_mul_ps(cy, _mm_set1_ps(plane.y)));
+            distance = _mm_add_ps(distance, _mm_mul_ps(cz, _mm_set1_ps(plane.z)));
+            culled = _mm_or_ps(culled, _mm_cmplt_ps(distance, negR));
+        }
+
+        if (backfaceCulling)
+        {
+            const __m128 dx = _mm_sub_ps(cx, _mm_set1_ps(cameraPosition.x));
+            const __m128 dy = _mm_sub_ps(cy, _mm_set1_ps(cameraPosition.y));
+            const __m128 dz = _mm_sub_ps(cz, _mm_set1_ps(cameraPosition.z));
+            const __m128 axisDotD = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&index.axisX[c]), dx),
+                                                          _mm_mul_ps(_mm_loadu_ps(&index.axisY[c]), dy)),
+                                               _mm_mul_ps(_mm_loadu_ps(&index.axisZ[c]), dz));
+            const __m128 dSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            const __m128 crossLength = _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(dSquared, _mm_mul_ps(axisDotD, axisDotD))));
+            const __m128 facing = _mm_sub_ps(_mm_mul_ps(axisDotD, _mm_loadu_ps(&index.coneCos[c])),
+                                             _mm_mul_ps(crossLength, _mm_loadu_ps(&index.coneSin[c])));
+            culled = _mm_or_ps(culled, _mm_cmpgt_ps(facing, r));
+        }
+
+        const int mask = _mm_movemask_ps(culled);
+        for (size_t k = 0; k < 4 && c + k < end; k++)
+        {
+            if (!(mask & (1 << k)))
+                visible.push_back(c + k);
+        }
+    }
+#else
+    for (size_t c = begin; c < end; c++)
+    {
+        const glm::vec3 center(index.centerX[c], index.centerY[c], index.centerZ[c]);
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            const auto &plane = planes[p];
+            inside = glm::dot(glm::vec3(plane), center) + plane.w + (p == 4 ? nearSlack : 0.0f) >= -index.radius[c];
+        }
+        if (inside && backfaceCulling)
+        {
+            const glm::vec3 axis(index.axisX[c], index.axisY[c], index.axisZ[c]);
+            const glm::vec3 d = center - cameraPosition;
+            const float axisDotD = glm::dot(axis, d);
+            const float crossLength = std::sqrt(std::max(0.0f, glm::dot(d, d) - axisDotD * axisDotD));
+            inside = axisDotD * index.coneCos[c] - crossLength * index.coneSin[c] <= index.radius[c];
+        }
+        if (inside)
+            visible.push_back(c);
+    }
+#endif
+}
+
+std::vector<size_t> cullClusters(const ChunkIndex &index, const std::vector<size_t> &chunks, const std::vector<size_t> &levels,
+                                 const std::array<glm::vec4, 6> &planes, float nearSlack,
+                                 const glm::vec3 &cameraPosition, bool backfaceCulling)
+{
+    auto cullChunkClusters = [&](size_t begin, size_t end) {
+        std::vector<size_t> visible;
+        for (size_t i = begin; i < end; i++)
+        {
+            const auto &level = index.chunks[chunks[i]].levels[levels[i]];
+            cullClusterRange(index, planes, nearSlack, cameraPosition, backfaceCulling,
+                             level.firstCluster, level.firstCluster + level.numClusters, visible);
+        }
+        return visible;
+    };
+
+    if (chunks.size() <= CHUNKS_PER_TASK)
+    {
+        return cullChunkClusters(0, chunks.size());
+    }
+
+    std::vector<std::future<std::vector<size_t>>> tasks;
+    for (size_t begin = 0; begin < chunks.size(); begin += CHUNKS_PER_TASK)
+    {
+        const size_t end = std::min(chunks.size(), begin + CHUNKS_PER_TASK);
+        tasks.push_back(ThreadPool::instance().submit([&, begin, end]() { return cullChunkClusters(begin, end); }));
+    }
+    std::vector<size_t> visible;
+    for (auto &task : tasks)
+    {
+        auto visibleInTask = ThreadPool::instance().wait(task);
+        visible.insert(visible.end(), visibleInTask.begin(), visibleInTask.end());
+    }
+    return visible;
+}
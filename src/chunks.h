@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "pointcloud.h"
+
+// Contiguous splats representing a chunk at one level of detail
+struct ChunkLevel
+{
+    size_t first;
+    size_t count;
+    size_t firstCluster;
+    size_t numClusters;
+    float splatRadius;  // largest splat radius of the level
+};
+
+// Axis aligned brick of the point cloud. The points of a chunk are stored contiguously,
+// chunks are stored in the same order as their points.
+struct Chunk
+{
+    glm::vec3 min;  // bounds already include the splat radii
+    glm::vec3 max;
+    std::vector<ChunkLevel> levels;  // the original points first, followed by coarser levels of detail
+};
+
+// Run of at most CLUSTER_SIZE consecutive splats inside one level of a chunk
+struct Cluster
+{
+    glm::vec3 center;  // bounding sphere, includes the splat radii
+    float radius;
+    glm::vec3 coneAxis;  // all splat normals lie within the cone around this axis
+    float coneCos;  // cosine and sine of the cone's half angle
+    float coneSin;
+    size_t first;
+    size_t count;
+};
+
+const size_t CLUSTER_SIZE = 256;
+
+struct ChunkIndex
+{
+    std::vector<Chunk> chunks;
+    std::vector<Cluster> clusters;
+    float chunkSize;
+
+    // Structure of arrays copy of the bounds for SIMD culling, padded to a multiple of 4
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    // Structure of arrays copy of the clusters for SIMD culling, padded by 3 elements
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> axisX, axisY, axisZ, coneCos, coneSin;
+};
+
+// Sorts the points into a grid of cubic bricks with the given edge length (in m) and
+// reorders all attributes of the point cloud accordingly. Empty bricks are dropped.
+// Every chunk is further split into clusters with bounding spheres and normal cones.
+ChunkIndex buildChunkIndex(PointCloud &pcl, float chunkSize);
+
+// (Re)builds the clusters of all levels of all chunks and the SIMD copies of the bounds
+void buildClusters(const PointCloud &pcl, ChunkIndex &index);
+
+// Returns the indices of all chunks that intersect the frustum given by its six planes
+// (left, right, bottom, top, near, far). nearSlack moves the near plane towards the camera.
+std::vector<size_t> cullChunks(const ChunkIndex &index, const std::array<glm::vec4, 6> &planes, float nearSlack);
+
+// Returns the indices of all clusters of the given chunks that intersect the frustum, levels holds
+// the level of detail of every chunk. With backfaceCulling, clusters whose splats all face away from
+// the camera are rejected as well.
+std::vector<size_t> cullClusters(const ChunkIndex &index, const std::vector<size_t> &chunks, const std::vector<size_t> &levels,
+                                 const std::array<glm::vec4, 6> &planes, float nearSlack,
+                                 const glm::vec3 &cameraPosition, bool backfaceCulling);
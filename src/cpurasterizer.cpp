@@ -0,0 +1,466 @@
+#define _USE_MATH_DEFINES
+
+#include "cpurasterizer.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define RASTERIZER_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// Splat after culling, everything the tiles need to rasterize it
+struct ScreenSplat
+{
+    glm::vec3 center;  // view space
+    float radius;
+    glm::vec3 normal;  // view space, not normalized
+    float centerDotNormal;
+    int x0, y0, x1, y1;  // covered pixels, inclusive
+};
+
+// Culled splats of a part of the clusters together with the splats overlapping each tile
+struct SplatBatch
+{
+    std::vector<ScreenSplat> splats;
+    std::vector<std::vector<uint32_t>> tiles;
+};
+
+// Computes the pixels covered by the disc, returns false if it is not on screen
+static bool screenBounds(const glm::vec3 &center, const glm::vec3 &normal, float radius, const glm::mat4 &projection,
+                         int width, int height, ScreenSplat &splat)
+{
+    // the square around the disc contains all of its pixels
+    const glm::vec3 n = glm::normalize(normal);
+    const glm::vec3 u = radius * glm::normalize(glm::cross(n, std::abs(n.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0)));
+    const glm::vec3 v = glm::cross(n, u);
+    glm::vec2 lower(std::numeric_limits<float>::max());
+    glm::vec2 upper(-std::numeric_limits<float>::max());
+    for (int k = 0; k < 4; k++)
+    {
+        const glm::vec3 corner = center + ((k & 1) ? u : -u) + ((k & 2) ? v : -v);
+        const glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+        if (clip.w <= 0.0f)
+        {
+            // reaches behind the camera
+            lower = glm::vec2(-1.0f);
+            upper = glm::vec2(1.0f);
+            break;
+        }
+        lower = glm::min(lower, glm::vec2(clip) / clip.w);
+        upper = glm::max(upper, glm::vec2(clip) / clip.w);
+    }
+    splat.x0 = std::max(static_cast<int>(std::floor((0.5f * lower.x + 0.5f) * width - 0.5f)), 0);
+    splat.y0 = std::max(static_cast<int>(std::floor((0.5f * lower.y + 0.5f) * height - 0.5f)), 0);
+    splat.x1 = std::min(static_cast<int>(std::ceil((0.5f * upper.x + 0.5f) * width - 0.5f)), width - 1);
+    splat.y1 = std::min(static_cast<int>(std::ceil((0.5f * upper.y + 0.5f) * height - 0.5f)), height - 1);
+    return splat.x0 <= splat.x1 && splat.y0 <= splat.y1;
+}
+
+// Transforms the splats of the clusters [begin, end) to view space, culls them and bins the survivors into tiles
+static void transformSplats(const PointCloud &pcl, const ChunkIndex &index, const std::vector<size_t> &clusters,
+                            size_t begin, size_t end, const glm::mat4 &view, const glm::mat4 &projection,
+                            int width, int height, bool backfaceCulling, float nearSlack, SplatBatch &batch)
+{
+    // near and far plane distances of the projection, nearSlack moves the near plane towards the camera
+    const float near = projection[3][2] / (projection[2][2] - 1.0f) - nearSlack;
+    const float far = projection[3][2] / (projection[2][2] + 1.0f);
+
+    auto addSplat = [&](size_t i, const glm::vec3 &center, const glm::vec3 &normal) {
+        ScreenSplat splat;
+        const float radius = pcl.radius[i];
+        if (!screenBounds(center, normal, radius, projection, width, height, splat))
+            return;
+        splat.center = center;
+        splat.radius = radius;
+        splat.normal = normal;
+        splat.centerDotNormal = glm::dot(center, normal);
+        batch.splats.push_back(splat);
+    };
+
+    for (size_t c = begin; c < end; c++)
+    {
+        const auto &cluster = index.clusters[clusters[c]];
+        size_t i = cluster.first;
+        const size_t last = cluster.first + cluster.count;
+#ifdef RASTERIZER_USE_SSE
+        // four splats at a time, culled by the near and far plane and by their orientation
+        for (; i + 4 <= last; i += 4)
+        {
+            const auto &p = pcl.position;
+            const auto &n = pcl.normal;
+            const __m128 px = _mm_setr_ps(p[i].x, p[i + 1].x, p[i + 2].x, p[i + 3].x);
+            const __m128 py = _mm_setr_ps(p[i].y, p[i + 1].y, p[i + 2].y, p[i + 3].y);
+            const __m128 pz = _mm_setr_ps(p[i].z, p[i + 1].z, p[i + 2].z, p[i + 3].z);
+            const __m128 nx = _mm_setr_ps(n[i].x, n[i + 1].x, n[i + 2].x, n[i + 3].x);
+            const __m128 ny = _mm_setr_ps(n[i].y, n[i + 1].y, n[i + 2].y, n[i + 3].y);
+            const __m128 nz = _mm_setr_ps(n[i].z, n[i + 1].z, n[i + 2].z, n[i + 3].z);
+            const __m128 r = _mm_loadu_ps(&pcl.radius[i]);
+
+            __m128 center[3];
+            __m128 normal[3];
+            for (int row = 0; row < 3; row++)
+            {
+                center[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(view[0][row])), _mm_mul_ps(py, _mm_set1_ps(view[1][row]))),
+                                         _mm_add_ps(_mm_mul_ps(pz, _mm_set1_ps(view[2][row])), _mm_set1_ps(view[3][row])));
+                normal[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(view[0][row])), _mm_mul_ps(ny, _mm_set1_ps(view[1][row]))),
+                                         _mm_mul_ps(nz, _mm_set1_ps(view[2][row])));
+            }
+            __m128 culled = _mm_or_ps(_mm_cmpgt_ps(_mm_sub_ps(center[2], r), _mm_set1_ps(-near)),
+                                      _mm_cmplt_ps(_mm_add_ps(center[2], r), _mm_set1_ps(-far)));
+            if (backfaceCulling)
+            {
+                const __m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normal[0], center[0]), _mm_mul_ps(normal[1], center[1])),
+                                                 _mm_mul_ps(normal[2], center[2]));
+                culled = _mm_or_ps(culled, _mm_cmpgt_ps(facing, _mm_setzero_ps()));
+            }
+            const int mask = _mm_movemask_ps(culled);
+            if (mask == 0xf)
+                continue;
+
+            alignas(16) float values[6][4];
+            for (int row = 0; row < 3; row++)
+            {
+                _mm_store_ps(values[row], center[row]);
+                _mm_store_ps(values[3 + row], normal[row]);
+            }
+            for (int k = 0; k < 4; k++)
+            {
+                if (!(mask & (1 << k)))
+                    addSplat(i + k, glm::vec3(values[0][k], values[1][k], values[2][k]),
+                             glm::vec3(values[3][k], values[4][k], values[5][k]));
+            }
+        }
+#endif
+        for (; i < last; i++)
+        {
+            const glm::vec3 center = glm::vec3(view * glm::vec4(pcl.position[i].x, pcl.position[i].y, pcl.position[i].z, 1.0f));
+            const glm::vec3 normal = glm::mat3(view) * glm::vec3(pcl.normal[i].x, pcl.normal[i].y, pcl.normal[i].z);
+            const float radius = pcl.radius[i];
+            if (center.z - radius > -near || center.z + radius < -far)
+                continue;
+            if (backfaceCulling && glm::dot(normal, center) > 0.0f)
+                continue;
+            addSplat(i, center, normal);
+        }
+    }
+
+    const int tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    const int tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    batch.tiles.assign(tilesX * tilesY, {});
+    for (size_t s = 0; s < batch.splats.size(); s++)
+    {
+        const auto &splat = batch.splats[s];
+        for (int ty = splat.y0 / RASTER_TILE_SIZE; ty <= splat.y1 / RASTER_TILE_SIZE; ty++)
+        {
+            for (int tx = splat.x0 / RASTER_TILE_SIZE; tx <= splat.x1 / RASTER_TILE_SIZE; tx++)
+            {
+                batch.tiles[ty * tilesX + tx].push_back(static_cast<uint32_t>(s));
+            }
+        }
+    }
+}
+
+// View rays through all pixel centers, padded so that groups of four pixels can always be loaded
+struct Rays
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+};
+
+// Culled splats of one frame, binned into tiles
+struct Frame
+{
+    Rays rays;
+    std::vector<SplatBatch> batches;
+    int tilesX;
+    int tilesY;
+};
+
+// Accumulators of one tile, padded so that groups of four pixels can always be loaded and stored
+struct Tile
+{
+    int x0, y0, x1, y1;  // inclusive
+    float depth[RASTER_TILE_SIZE * RASTER_TILE_SIZE + 4];  // closest window depth, with EWA of the visibility pass
+    float viewDepth[RASTER_TILE_SIZE * RASTER_TILE_SIZE + 4];  // view space depth of the closest splat
+    float weight[RASTER_TILE_SIZE * RASTER_TILE_SIZE + 4];  // EWA only, sum of the splat weights
+    float weightedDepth[RASTER_TILE_SIZE * RASTER_TILE_SIZE + 4];  // EWA only, sum of the weighted window depths
+};
+
+// Point where a view ray hits a disc
+struct RayHit
+{
+    glm::vec3 position;  // view space
+    float distanceSquared;  // to the center of the disc
+    float depth;  // window depth
+};
+
+static Frame prepareFrame(const PointCloud &pcl, const ChunkIndex &index, const std::vector<size_t> &clusters,
+                          const glm::mat4 &view, const glm::mat4 &projection, int width, int height,
+                          bool backfaceCulling, float nearSlack)
+{
+    Frame frame;
+    const auto inverseProjection = glm::inverse(projection);
+    frame.rays.x.assign(static_cast<size_t>(width) * height + 4, 0.0f);
+    frame.rays.y.assign(frame.rays.x.size(), 0.0f);
+    frame.rays.z.assign(frame.rays.x.size(), 0.0f);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const glm::vec2 ndc = 2.0f * (glm::vec2(x, y) + 0.5f) / glm::vec2(width, height) - 1.0f;
+            const glm::vec4 onNear = inverseProjection * glm::vec4(ndc, -1.0f, 1.0f);
+            const size_t ray = static_cast<size_t>(y) * width + x;
+            frame.rays.x[ray] = onNear.x / onNear.w;
+            frame.rays.y[ray] = onNear.y / onNear.w;
+            frame.rays.z[ray] = onNear.z / onNear.w;
+        }
+    }
+
+    // TRANSFORM AND BINNING
+    const size_t numTasks = std::min<size_t>(ThreadPool::instance().concurrency(), std::max<size_t>(clusters.size(), 1));
+    frame.batches.resize(numTasks);
+    std::vector<std::future<void>> tasks;
+    for (size_t t = 0; t < numTasks; t++)
+    {
+        const size_t begin = clusters.size() * t / numTasks;
+        const size_t end = clusters.size() * (t + 1) / numTasks;
+        tasks.push_back(ThreadPool::instance().submit([&, t, begin, end]() {
+            transformSplats(pcl, index, clusters, begin, end, view, projection, width, height, backfaceCulling,
+                            nearSlack, frame.batches[t]);
+        }));
+    }
+    for (auto &task : tasks)
+    {
+        ThreadPool::instance().wait(task);
+    }
+    frame.tilesX = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    frame.tilesY = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    return frame;
+}
+
+static float windowDepth(const glm::mat4 &projection, const glm::vec3 &position)
+{
+    const glm::vec4 clip = projection * glm::vec4(position, 1.0f);
+    return 0.5f * clip.z / clip.w + 0.5f;
+}
+
+// Calls visit(pixel, hit) for all pixels of the tile whose view ray hits the disc, pixel is relative to the tile
+template <typename Visit>
+static void forEachHit(const ScreenSplat &splat, const glm::mat4 &projection, const Rays &rays, int width,
+                       const Tile &tile, const Visit &visit)
+{
+    const int x0 = std::max(splat.x0, tile.x0);
+    const int x1 = std::min(splat.x1, tile.x1);
+    const int y0 = std::max(splat.y0, tile.y0);
+    const int y1 = std::min(splat.y1, tile.y1);
+    const float radiusSquared = splat.radius * splat.radius;
+#ifdef RASTERIZER_USE_SSE
+    // the intersections are computed for four pixels of a row at a time
+    const __m128 cx = _mm_set1_ps(splat.center.x);
+    const __m128 cy = _mm_set1_ps(splat.center.y);
+    const __m128 cz = _mm_set1_ps(splat.center.z);
+    const __m128 nx = _mm_set1_ps(splat.normal.x);
+    const __m128 ny = _mm_set1_ps(splat.normal.y);
+    const __m128 nz = _mm_set1_ps(splat.normal.z);
+    const __m128 cn = _mm_set1_ps(splat.centerDotNormal);
+    const __m128 r2 = _mm_set1_ps(radiusSquared);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    alignas(16) float values[5][4];
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x += 4)
+        {
+            const size_t ray = static_cast<size_t>(y) * width + x;
+            const __m128 dx = _mm_loadu_ps(&rays.x[ray]);
+            const __m128 dy = _mm_loadu_ps(&rays.y[ray]);
+            const __m128 dz = _mm_loadu_ps(&rays.z[ray]);
+            // intersection of the rays with the plane of the disc
+            const __m128 dn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)), _mm_mul_ps(dz, nz));
+            const __m128 t = _mm_div_ps(cn, dn);
+            const __m128 p[3] = {_mm_mul_ps(t, dx), _mm_mul_ps(t, dy), _mm_mul_ps(t, dz)};
+            const __m128 ox = _mm_sub_ps(p[0], cx);
+            const __m128 oy = _mm_sub_ps(p[1], cy);
+            const __m128 oz = _mm_sub_ps(p[2], cz);
+            const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz));
+            __m128 hit = _mm_and_ps(_mm_cmple_ps(distance, r2), _mm_cmpgt_ps(t, zero));
+            hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes), _mm_set1_ps(static_cast<float>(x1))));
+            const int mask = _mm_movemask_ps(hit);
+            if (mask == 0)
+                continue;
+
+            __m128 clipZ = _mm_set1_ps(projection[3][2]);
+            __m128 clipW = _mm_set1_ps(projection[3][3]);
+            for (int col = 0; col < 3; col++)
+            {
+                clipZ = _mm_add_ps(clipZ, _mm_mul_ps(p[col], _mm_set1_ps(projection[col][2])));
+                clipW = _mm_add_ps(clipW, _mm_mul_ps(p[col], _mm_set1_ps(projection[col][3])));
+            }
+            _mm_store_ps(values[0], p[0]);
+            _mm_store_ps(values[1], p[1]);
+            _mm_store_ps(values[2], p[2]);
+            _mm_store_ps(values[3], distance);
+            _mm_store_ps(values[4], _mm_add_ps(_mm_mul_ps(half, _mm_div_ps(clipZ, clipW)), half));
+            const size_t pixel = (y - tile.y0) * RASTER_TILE_SIZE + (x - tile.x0);
+            for (int k = 0; k < 4; k++)
+            {
+                if (mask & (1 << k))
+                    visit(pixel + k, RayHit{glm::vec3(values[0][k], values[1][k], values[2][k]), values[3][k], values[4][k]});
+            }
+        }
+    }
+#else
+    for (int y = y0; y <= y1; y++)
+    {
+        for (int x = x0; x <= x1; x++)
+        {
+            const size_t ray = static_cast<size_t>(y) * width + x;
+            const glm::vec3 direction(rays.x[ray], rays.y[ray], rays.z[ray]);
+            const float t = splat.centerDotNormal / glm::dot(direction, splat.normal);
+            const glm::vec3 position = t * direction;
+            const glm::vec3 offset = position - splat.center;
+            const float distanceSquared = glm::dot(offset, offset);
+            if (t > 0.0f && distanceSquared <= radiusSquared)
+                visit((y - tile.y0) * RASTER_TILE_SIZE + (x - tile.x0), RayHit{position, distanceSquared, windowDepth(projection, position)});
+        }
+    }
+#endif
+}
+
+// Runs work(t, tile) for every tile t on all cores, the work has to visit the batches in order to keep the
+// order of the splats. finish(tile, pixel, output) then writes every pixel of the tile to the output.
+template <typename Work, typename Finish>
+static void forEachTile(const Frame &frame, int width, int height, const Work &work, const Finish &finish)
+{
+    parallelForStealing(static_cast<size_t>(frame.tilesX) * frame.tilesY, [&](size_t t) {
+        Tile tile;
+        tile.x0 = static_cast<int>(t % frame.tilesX) * RASTER_TILE_SIZE;
+        tile.y0 = static_cast<int>(t / frame.tilesX) * RASTER_TILE_SIZE;
+        tile.x1 = std::min(tile.x0 + RASTER_TILE_SIZE, width) - 1;
+        tile.y1 = std::min(tile.y0 + RASTER_TILE_SIZE, height) - 1;
+        std::fill(std::begin(tile.depth), std::end(tile.depth), 1.0f);
+        std::fill(std::begin(tile.viewDepth), std::end(tile.viewDepth), 0.0f);
+        std::fill(std::begin(tile.weight), std::end(tile.weight), 0.0f);
+        std::fill(std::begin(tile.weightedDepth), std::end(tile.weightedDepth), 0.0f);
+        work(t, tile);
+        for (int y = tile.y0; y <= tile.y1; y++)
+        {
+            for (int x = tile.x0; x <= tile.x1; x++)
+            {
+                finish(tile, (y - tile.y0) * RASTER_TILE_SIZE + (x - tile.x0), static_cast<size_t>(y) * width + x);
+            }
+        }
+    });
+}
+
+static size_t numSplats(const Frame &frame)
+{
+    size_t count = 0;
+    for (const auto &batch : frame.batches)
+    {
+        count += batch.splats.size();
+    }
+    return count;
+}
+
+static unsigned char toUnorm8(float value)
+{
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+size_t rasterizeSplats(const PointCloud &pcl, const ChunkIndex &index, const std::vector<size_t> &clusters,
+                       const glm::mat4 &view, const glm::mat4 &projection, int width, int height,
+                       bool backfaceCulling, unsigned char *color, float *depth)
+{
+    TRACE_ZONE("rasterizeSplats");
+    const auto frame = prepareFrame(pcl, index, clusters, view, projection, width, height, backfaceCulling, 0.0f);
+    forEachTile(frame, width, height,
+        [&](size_t t, Tile &tile) {
+            for (const auto &batch : frame.batches)
+            {
+                for (auto s : batch.tiles[t])
+                {
+                    forEachHit(batch.splats[s], projection, frame.rays, width, tile, [&](size_t pixel, const RayHit &hit) {
+                        if (hit.depth >= 0.0f && hit.depth < 1.0f && hit.depth < tile.depth[pixel])
+                        {
+                            tile.depth[pixel] = hit.depth;
+                            tile.viewDepth[pixel] = hit.position.z;
+                        }
+                    });
+                }
+            }
+        },
+        [&](const Tile &tile, size_t pixel, size_t output) {
+            // same output as splat.frag
+            const auto value = toUnorm8(-tile.viewDepth[pixel] / 5.0f);
+            color[3 * output] = value;
+            color[3 * output + 1] = value;
+            color[3 * output + 2] = value;
+            depth[output] = tile.depth[pixel];
+        });
+    return numSplats(frame);
+}
+
+size_t splatEWA(const PointCloud &pcl, const ChunkIndex &index, const std::vector<size_t> &clusters,
+                const glm::mat4 &view, const glm::mat4 &projection, int width, int height,
+                bool backfaceCulling, float surfaceThickness, unsigned char *color, float *depth)
+{
+    TRACE_ZONE("splatEWA");
+    const auto frame = prepareFrame(pcl, index, clusters, view, projection, width, height, backfaceCulling, surfaceThickness);
+    forEachTile(frame, width, height,
+        [&](size_t t, Tile &tile) {
+            // VISIBILITY PASS
+            // depth of the splats moved away from the camera by the surface thickness (see visibility.vert)
+            for (const auto &batch : frame.batches)
+            {
+                for (auto s : batch.tiles[t])
+                {
+                    forEachHit(batch.splats[s], projection, frame.rays, width, tile, [&](size_t pixel, const RayHit &hit) {
+                        const glm::vec3 moved = hit.position + surfaceThickness * glm::normalize(hit.position);
+                        const float movedDepth = windowDepth(projection, moved);
+                        if (movedDepth >= 0.0f && movedDepth < 1.0f && movedDepth < tile.depth[pixel])
+                            tile.depth[pixel] = movedDepth;
+                    });
+                }
+            }
+
+            // ACCUMULATION PASS
+            // Gaussian weights of all splats in front of the visibility depth (see splatcount.frag)
+            for (const auto &batch : frame.batches)
+            {
+                for (auto s : batch.tiles[t])
+                {
+                    const auto &splat = batch.splats[s];
+                    const float sigma = splat.radius / 4.0f;
+                    const float scale = 1.0f / (sigma * std::sqrt(2.0f * static_cast<float>(M_PI)));
+                    const float exponent = -1.0f / (2.0f * sigma * sigma);
+                    forEachHit(splat, projection, frame.rays, width, tile, [&](size_t pixel, const RayHit &hit) {
+                        if (hit.depth >= 0.0f && hit.depth < 1.0f && hit.depth < tile.depth[pixel])
+                        {
+                            const float weight = scale * std::exp(exponent * hit.distanceSquared);
+                            tile.weight[pixel] += weight;
+                            tile.weightedDepth[pixel] += weight * hit.depth;
+                        }
+                    });
+                }
+            }
+        },
+        [&](const Tile &tile, size_t pixel, size_t output) {
+            // INTERPOLATION PASS
+            // same output as final.frag
+            const auto value = toUnorm8(tile.weight[pixel] / 200.0f);
+            color[3 * output] = value;
+            color[3 * output + 1] = value;
+            color[3 * output + 2] = value;
+            depth[output] = tile.weight[pixel] > 0.0f ? tile.weightedDepth[pixel] / tile.weight[pixel] : 1.0f;
+        });
+    return numSplats(frame);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "pointcloud.h"
+#include "chunks.h"
+
+// Edge length of the screen tiles the CPU rasterizer works on, in pixels
+const int RASTER_TILE_SIZE = 32;
+
+// Renders the splats of the given clusters like the standard method does on the GPU, but entirely on
+// the CPU. color receives width * height RGB8 pixels and depth the window depth in [0, 1] of every pixel,
+// both starting with the bottom row like glReadPixels. Returns the number of splats that were not culled.
+size_t rasterizeSplats(const PointCloud &pcl, const ChunkIndex &index, const std::vector<size_t> &clusters,
+                       const glm::mat4 &view, const glm::mat4 &projection, int width, int height,
+                       bool backfaceCulling, unsigned char *color, float *depth);
+
+// Renders the splats of the given clusters with the three passes of the EWA method on the CPU. Splats
+// within surfaceThickness behind the closest surface are blended with Gaussian weights.
+size_t splatEWA(const PointCloud &pcl, const ChunkIndex &index, const std::vector<size_t> &clusters,
+                const glm::mat4 &view, const glm::mat4 &projection, int width, int height,
+                bool backfaceCulling, float surfaceThickness, unsigned char *color, float *depth);
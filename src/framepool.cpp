@@ -0,0 +1,460 @@
+#include "framepool.h"
+#include "lodepng.h"
+#include "memorystats.h"
+#include "parallel.h"
+#include "simd.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// Slabs start at cache line boundaries
+const size_t SLAB_ALIGNMENT = 64;
+const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+// lodepng allocations are 16 byte aligned and keep a header in front of them (see BlockHeader)
+const size_t ARENA_ALIGNMENT = 16;
+const size_t ARENA_HEADER = 32;
+
+// Returns memory of at least size bytes, rounded up to whole huge pages if they are used
+static unsigned char *allocatePages(size_t &size, bool &huge)
+{
+#ifdef __linux__
+    const size_t rounded = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    // reserved huge pages first, then transparent huge pages
+    void *memory = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    huge = memory != MAP_FAILED;
+    if (!huge)
+    {
+        memory = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        huge = madvise(memory, rounded, MADV_HUGEPAGE) == 0;
+#endif
+    }
+    size = rounded;
+    return static_cast<unsigned char *>(memory);
+#elif defined(_WIN32)
+    // large pages need the privilege to lock memory, regular pages are used without it
+    const size_t largePage = GetLargePageMinimum();
+    if (largePage > 0)
+    {
+        const size_t rounded = (size + largePage - 1) / largePage * largePage;
+        void *memory = VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        if (memory)
+        {
+            huge = true;
+            size = rounded;
+            return static_cast<unsigned char *>(memory);
+        }
+    }
+    huge = false;
+    void *memory = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!memory)
+        throw std::bad_alloc();
+    return static_cast<unsigned char *>(memory);
+#else
+    huge = false;
+    return new unsigned char[size];
+#endif
+}
+
+static void freePages(unsigned char *memory, size_t size)
+{
+#ifdef __linux__
+    munmap(memory, size);
+#elif defined(_WIN32)
+    (void)size;
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    (void)size;
+    delete[] memory;
+#endif
+}
+
+FramePool::FramePool(size_t slabSize, size_t numSlabs) : numSlabs(numSlabs)
+{
+    slabSize = (slabSize + SLAB_ALIGNMENT - 1) / SLAB_ALIGNMENT * SLAB_ALIGNMENT;
+    size = slabSize * numSlabs;
+    memory = allocatePages(size, huge);
+    MemoryStats::instance().add(MemoryCategory::FrameBuffers, size);
+    // all pages are touched now instead of during the first frames
+    std::memset(memory, 0, size);
+    available.reserve(numSlabs);
+    for (size_t s = 0; s < numSlabs; s++)
+    {
+        available.push_back(memory + s * slabSize);
+    }
+}
+
+FramePool::~FramePool()
+{
+    waitIdle();
+    freePages(memory, size);
+    MemoryStats::instance().remove(MemoryCategory::FrameBuffers, size);
+}
+
+unsigned char *FramePool::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this]() { return !available.empty(); });
+    auto slab = available.back();
+    available.pop_back();
+    return slab;
+}
+
+void FramePool::release(unsigned char *slab)
+{
+    // notified under the lock, waitIdle may return and the pool be destroyed as soon as it is released
+    std::lock_guard<std::mutex> lock(mutex);
+    available.push_back(slab);
+    released.notify_all();
+}
+
+void FramePool::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    released.wait(lock, [this]() { return available.size() == numSlabs; });
+}
+
+// ENCODER ARENA
+
+struct EncoderArena
+{
+    unsigned char *memory = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t overflow = 0;  // live bytes of the current scope that did not fit and came from the heap
+    size_t required = 0;  // largest demand of the current scope, the used arena and the live overflow
+    unsigned char *last = nullptr;  // the allocation at the end, which can grow in place
+
+    ~EncoderArena()
+    {
+        std::free(memory);
+        MemoryStats::instance().remove(MemoryCategory::EncodeTemporaries, capacity);
+    }
+};
+
+// Arenas are shared by all threads and taken by the scopes, there are never more of them than images encoded
+// at the same time, which the frames in flight limit
+static std::mutex arenasMutex;
+static std::vector<std::unique_ptr<EncoderArena>> freeArenas;
+static thread_local EncoderArena *arena = nullptr;
+
+static size_t arenaSize(size_t size)
+{
+    return ARENA_HEADER + (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+EncoderArenaScope::EncoderArenaScope()
+{
+    {
+        std::lock_guard<std::mutex> lock(arenasMutex);
+        if (freeArenas.empty())
+        {
+            arena = new EncoderArena();
+        }
+        else
+        {
+            arena = freeArenas.back().release();
+            freeArenas.pop_back();
+        }
+    }
+    arena->used = 0;
+    arena->overflow = 0;
+    arena->required = 0;
+    arena->last = nullptr;
+}
+
+EncoderArenaScope::~EncoderArenaScope()
+{
+    // the next image of the same size fits entirely, with some room for images that compress worse
+    if (arena->required > arena->capacity)
+    {
+        auto &stats = MemoryStats::instance();
+        const size_t capacity = arena->required + arena->required / 8;
+        try
+        {
+            stats.checkBudget("An encoder arena", capacity - arena->capacity);
+            std::free(arena->memory);
+            stats.remove(MemoryCategory::EncodeTemporaries, arena->capacity);
+            arena->capacity = capacity;
+            arena->memory = static_cast<unsigned char *>(std::malloc(arena->capacity));
+            if (!arena->memory)
+                arena->capacity = 0;
+            stats.add(MemoryCategory::EncodeTemporaries, arena->capacity);
+        }
+        catch (const MemoryBudgetExceeded &e)
+        {
+            // keeps encoding with the smaller arena, what does not fit is only allocated while it is used
+            static std::atomic<bool> warned{false};
+            if (!warned.exchange(true))
+                std::cerr << e.what() << ", encoding partly allocates from the heap" << std::endl;
+        }
+    }
+    std::lock_guard<std::mutex> lock(arenasMutex);
+    freeArenas.emplace_back(arena);
+    arena = nullptr;
+}
+
+size_t encoderArenaEstimate(size_t pixels)
+{
+    // measured for gradients and noise as color and depth images between 160x120 and 1920x1440, noise needs
+    // the most, with some margin
+    return (size_t(1) << 20) + 44 * pixels;
+}
+
+// Frees and reallocations are routed by the arena a block is tagged with, not by the arena of the calling
+// thread, so a block that outlives its scope is never passed to std::free as a pointer into an arena
+struct BlockHeader
+{
+    size_t size;
+    EncoderArena *arena;       // the arena the block lies in, nullptr for heap blocks
+    EncoderArena *overflowed;  // heap blocks only, the arena whose scope they were counted for
+};
+static_assert(sizeof(BlockHeader) <= ARENA_HEADER, "lodepng allocations do not fit their header");
+
+static BlockHeader &header(unsigned char *block)
+{
+    return *reinterpret_cast<BlockHeader *>(block);
+}
+
+// Heap block for an allocation that does not fit into the arena or is made outside of any scope
+static void *heapAllocate(size_t size)
+{
+    auto block = static_cast<unsigned char *>(std::malloc(ARENA_HEADER + size));
+    if (!block)
+        return nullptr;
+    header(block) = {size, nullptr, arena};
+    if (arena)
+    {
+        arena->overflow += size;
+        arena->required = std::max(arena->required, arena->used + arena->overflow);
+        MemoryStats::instance().add(MemoryCategory::EncodeTemporaries, size);
+    }
+    return block + ARENA_HEADER;
+}
+
+static void heapFree(unsigned char *block)
+{
+    const auto &tag = header(block);
+    if (tag.overflowed)
+    {
+        // freed after its scope ended, nothing is counted for the arena any more
+        if (tag.overflowed == arena)
+            arena->overflow -= tag.size;
+        MemoryStats::instance().remove(MemoryCategory::EncodeTemporaries, tag.size);
+    }
+    std::free(block);
+}
+
+// lodepng is compiled with LODEPNG_NO_COMPILE_ALLOCATORS and uses these
+void *lodepng_malloc(size_t size)
+{
+    if (!arena)
+        return heapAllocate(size);
+    const size_t needed = arenaSize(size);
+    if (arena->used + needed > arena->capacity)
+        return heapAllocate(size);
+    unsigned char *block = arena->memory + arena->used;
+    header(block) = {size, arena, nullptr};
+    arena->used += needed;
+    arena->required = std::max(arena->required, arena->used + arena->overflow);
+    arena->last = block + ARENA_HEADER;
+    return arena->last;
+}
+
+void lodepng_free(void *ptr)
+{
+    if (!ptr)
+        return;
+    unsigned char *block = static_cast<unsigned char *>(ptr) - ARENA_HEADER;
+    EncoderArena *owner = header(block).arena;
+    if (!owner)
+    {
+        heapFree(block);
+        return;
+    }
+    // only the last allocation gives its memory back before the scope ends, the rest goes with the scope
+    if (owner == arena && ptr == arena->last)
+    {
+        arena->used = block - arena->memory;
+        arena->last = nullptr;
+    }
+}
+
+void *lodepng_realloc(void *ptr, size_t newSize)
+{
+    if (!ptr)
+        return lodepng_malloc(newSize);
+
+    unsigned char *block = static_cast<unsigned char *>(ptr) - ARENA_HEADER;
+    const size_t oldSize = header(block).size;
+    if (header(block).arena == arena && arena && ptr == arena->last)
+    {
+        const size_t offset = block - arena->memory;
+        if (offset + arenaSize(newSize) <= arena->capacity)
+        {
+            header(block).size = newSize;
+            arena->used = offset + arenaSize(newSize);
+            arena->required = std::max(arena->required, arena->used + arena->overflow);
+            return ptr;
+        }
+    }
+    void *moved = lodepng_malloc(newSize);
+    if (!moved)
+        return nullptr;
+    std::memcpy(moved, ptr, std::min(oldSize, newSize));
+    lodepng_free(ptr);
+    return moved;
+}
+
+// FRAME WRITER
+
+// A slab holds the number of unfinished tasks of its frame, followed by the rendered depth, the rendered
+// color, the flipped color and the packed depth
+static size_t slabSize(size_t pixels)
+{
+    return SLAB_ALIGNMENT + (3 + 4 + 3 + 2) * pixels;
+}
+
+// One frame per thread is encoded while the next one is rendered, fewer if the slabs and the encoder arenas
+// of their two images exceed the memory budget
+static size_t framesInFlight(size_t pixels)
+{
+    const size_t frameBytes = slabSize(pixels) + 2 * encoderArenaEstimate(pixels);
+    const size_t wanted = ThreadPool::instance().concurrency() + 1;
+    const size_t fitting = MemoryStats::instance().available() / frameBytes;
+    if (fitting == 0)
+        MemoryStats::instance().checkBudget("A frame", frameBytes);
+    if (fitting < wanted)
+        std::cout << "\tMemory budget: " << fitting << " instead of " << wanted << " frames in flight" << std::endl;
+    return std::min(wanted, fitting);
+}
+
+static std::atomic<int> &pendingTasks(unsigned char *slab)
+{
+    return *std::launder(reinterpret_cast<std::atomic<int> *>(slab));
+}
+
+static void encodePng(const char *fileName, const unsigned char *image, int width, int height, LodePNGColorType colorType,
+                      unsigned bitDepth, StageTimes &times)
+{
+    EncoderArenaScope scope;
+    unsigned char *png = nullptr;
+    size_t pngSize = 0;
+    unsigned error;
+    {
+        StageTimer timer(times, Stage::Encode);
+        TRACE_ZONE("encode");
+        error = lodepng_encode_memory(&png, &pngSize, image, width, height, colorType, bitDepth);
+    }
+    if (!error)
+    {
+        StageTimer timer(times, Stage::FileWrite);
+        TRACE_ZONE("write");
+        error = lodepng_save_file(png, pngSize, fileName);
+    }
+    if (!error)
+        times.addBytesWritten(pngSize);
+    lodepng_free(png);
+    if (error)
+        std::cerr << "Could not write " << fileName << ": " << lodepng_error_text(error) << std::endl;
+}
+
+FrameWriter::FrameWriter(const std::string &outputPath, int delta, int width, int height, float near, float far, float depthScale,
+                         StageTimes &times)
+    : outputPath(outputPath), delta(delta), width(width), height(height), near(near), far(far), depthScale(depthScale),
+      pixels(size_t(width) * height),
+      framePool(slabSize(pixels), framesInFlight(pixels)), times(times)
+{
+    std::experimental::filesystem::create_directories(outputPath + "/debug");
+    std::experimental::filesystem::create_directories(outputPath + "/depth");
+}
+
+FrameWriter::~FrameWriter()
+{
+    finish();
+}
+
+FrameWriter::Frame FrameWriter::next()
+{
+    if (current)
+        framePool.release(current);
+    StageTimer timer(times, Stage::WriterWait);
+    TRACE_ZONE("wait for frame slab");
+    current = framePool.acquire();
+    return {current + SLAB_ALIGNMENT + 4 * pixels, reinterpret_cast<float *>(current + SLAB_ALIGNMENT)};
+}
+
+void FrameWriter::write()
+{
+    unsigned char *slab = current;
+    current = nullptr;
+    const int frame = numFrames++ * delta;
+    new (slab) std::atomic<int>(2);
+    auto &threadPool = ThreadPool::instance();
+    threadPool.submit([this, slab, frame]() { writeColor(slab, frame); });
+    threadPool.submit([this, slab, frame]() { writeDepth(slab, frame); });
+}
+
+void FrameWriter::finish()
+{
+    if (current)
+    {
+        framePool.release(current);
+        current = nullptr;
+    }
+    framePool.waitIdle();
+}
+
+void FrameWriter::writeColor(unsigned char *slab, int frame)
+{
+    const unsigned char *color = slab + SLAB_ALIGNMENT + 4 * pixels;
+    unsigned char *flipped = slab + SLAB_ALIGNMENT + 7 * pixels;
+    {
+        StageTimer timer(times, Stage::Conversion);
+        TRACE_ZONE("flip");
+        flipRows(color, flipped, size_t(width) * 3, height);
+    }
+    char fileName[4096];
+    std::snprintf(fileName, sizeof(fileName), "%s/debug/%05d.png", outputPath.c_str(), frame);
+    encodePng(fileName, flipped, width, height, LCT_RGB, 8U, times);
+    done(slab);
+}
+
+void FrameWriter::writeDepth(unsigned char *slab, int frame)
+{
+    const float *depth = reinterpret_cast<const float *>(slab + SLAB_ALIGNMENT);
+    unsigned char *packed = slab + SLAB_ALIGNMENT + 10 * pixels;
+    // flipped, linearized and converted to 16 bit millimeters at once
+    {
+        StageTimer timer(times, Stage::Conversion);
+        TRACE_ZONE("packDepth");
+        packDepth(depth, packed, width, height, near, far, depthScale);
+    }
+    char fileName[4096];
+    std::snprintf(fileName, sizeof(fileName), "%s/depth/%05d.png", outputPath.c_str(), frame);
+    encodePng(fileName, packed, width, height, LCT_GREY, 16U, times);
+    done(slab);
+}
+
+void FrameWriter::done(unsigned char *slab)
+{
+    if (pendingTasks(slab).fetch_sub(1) == 1)
+        framePool.release(slab);
+}
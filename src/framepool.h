@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "stagetimes.h"
+
+// Fixed number of equally sized slabs, allocated at once on huge pages where the system provides them.
+// A frame keeps its slab from readback over conversion to the written PNG files and returns it
+// afterwards, so rendering does not allocate per frame and memory does not grow with the frame count.
+class FramePool
+{
+public:
+    FramePool(size_t slabSize, size_t numSlabs);
+    ~FramePool();
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    // Waits until a slab is free
+    unsigned char *acquire();
+    void release(unsigned char *slab);
+    // Waits until all slabs were released
+    void waitIdle();
+
+    size_t bytes() const { return size; }
+    bool hugePages() const { return huge; }
+
+private:
+    unsigned char *memory = nullptr;
+    size_t size = 0;
+    size_t numSlabs;
+    bool huge = false;
+    std::mutex mutex;
+    std::condition_variable released;
+    std::vector<unsigned char *> available;
+};
+
+// While it exists lodepng allocates on the calling thread from an arena taken from a shared pool. Arenas grow
+// to the largest image encoded in them so far and are reused afterwards, so encoding does not allocate in
+// steady state and there are only as many arenas as images encoded at the same time.
+class EncoderArenaScope
+{
+public:
+    EncoderArenaScope();
+    ~EncoderArenaScope();
+    EncoderArenaScope(const EncoderArenaScope &) = delete;
+    EncoderArenaScope &operator=(const EncoderArenaScope &) = delete;
+};
+
+// Allocator of lodepng, images encoded inside a scope have to be freed with it before the scope ends
+void lodepng_free(void *ptr);
+
+// Bytes an arena needs to encode a color or depth image with this many pixels
+size_t encoderArenaEstimate(size_t pixels);
+
+// Writes the color and depth images of consecutive frames as PNG files into outputPath/debug and
+// outputPath/depth. Each frame lives in one slab of a FramePool, it is flipped, converted and encoded on
+// the thread pool while the next frames are rendered, and its slab is reused once both files are written.
+class FrameWriter
+{
+public:
+    struct Frame
+    {
+        unsigned char *color;  // 3 bytes per pixel, starting with the bottom row
+        float *depth;  // window depth, starting with the bottom row
+    };
+
+    // The time spent converting, encoding and writing and the written bytes are added to times
+    FrameWriter(const std::string &outputPath, int delta, int width, int height, float near, float far, float depthScale,
+                StageTimes &times);
+    // Waits until all frames are written
+    ~FrameWriter();
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    // Memory for the next frame, waits while all slabs are being written
+    Frame next();
+    // Writes the frame returned by the last call of next
+    void write();
+    // Waits until all frames are written
+    void finish();
+
+    const FramePool &pool() const { return framePool; }
+
+private:
+    void writeColor(unsigned char *slab, int frame);
+    void writeDepth(unsigned char *slab, int frame);
+    void done(unsigned char *slab);
+
+    std::string outputPath;
+    int delta, width, height;
+    float near, far, depthScale;
+    size_t pixels;
+    FramePool framePool;
+    StageTimes &times;
+    unsigned char *current = nullptr;
+    int numFrames = 0;
+};
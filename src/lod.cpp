@@ -0,0 +1,345 @@
+#include "lod.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+
+namespace fs = std::experimental::filesystem;
+
+// Cell size of the finest level of detail relative to the chunk size, every further level doubles it
+const float FINEST_LOD_CELL = 1.0f / 64.0f;
+
+// Levels are only kept if they reduce the number of splats of the previous level at least by this factor
+const float MIN_LOD_REDUCTION = 0.5f;
+
+const uint32_t HIERARCHY_MAGIC = 0x48544c53;  // "SLTH"
+const uint32_t HIERARCHY_VERSION = 3;
+
+// Copies the splats [first, first + count) of the point cloud
+static PointCloud slice(const PointCloud &pcl, size_t first, size_t count)
+{
+    PointCloud part;
+    part.position.assign(pcl.position.begin() + first, pcl.position.begin() + first + count);
+    part.color.assign(pcl.color.begin() + first, pcl.color.begin() + first + count);
+    part.normal.assign(pcl.normal.begin() + first, pcl.normal.begin() + first + count);
+    if (!pcl.confidence.empty())
+        part.confidence.assign(pcl.confidence.begin() + first, pcl.confidence.begin() + first + count);
+    part.radius.assign(pcl.radius.begin() + first, pcl.radius.begin() + first + count);
+    part.sourceIndex.assign(pcl.sourceIndex.begin() + first, pcl.sourceIndex.begin() + first + count);
+    part.size = count;
+    return part;
+}
+
+// Replaces the splats in every grid cell by one splat at their centroid that covers all of them
+static PointCloud mergeSplats(const PointCloud &source, const glm::vec3 &origin, float cellSize)
+{
+    std::vector<std::pair<uint64_t, uint32_t>> cells(source.size);
+    for (size_t i = 0; i < source.size; i++)
+    {
+        const auto &p = source.position[i];
+        auto cell = glm::uvec3(glm::max((glm::vec3(p.x, p.y, p.z) - origin) / cellSize, 0.0f));
+        cells[i] = {(uint64_t(cell.z) << 42) | (uint64_t(cell.y) << 21) | uint64_t(cell.x), static_cast<uint32_t>(i)};
+    }
+    std::sort(cells.begin(), cells.end());
+
+    PointCloud merged;
+    for (size_t begin = 0; begin < cells.size();)
+    {
+        size_t end = begin + 1;
+        while (end < cells.size() && cells[end].first == cells[begin].first)
+            end++;
+
+        glm::vec3 center(0.0f);
+        glm::vec3 normal(0.0f);
+        glm::vec3 color(0.0f);
+        float confidence = 0.0f;
+        for (size_t k = begin; k < end; k++)
+        {
+            const auto i = cells[k].second;
+            const auto &p = source.position[i];
+            const auto &n = source.normal[i];
+            const auto &c = source.color[i];
+            center += glm::vec3(p.x, p.y, p.z);
+            normal += glm::vec3(n.x, n.y, n.z);
+            color += glm::vec3(c.r, c.g, c.b);
+            if (!source.confidence.empty())
+                confidence += source.confidence[i];
+        }
+        const float count = static_cast<float>(end - begin);
+        center /= count;
+        color = color / count + 0.5f;
+
+        float radius = 0.0f;
+        for (size_t k = begin; k < end; k++)
+        {
+            const auto i = cells[k].second;
+            const auto &p = source.position[i];
+            radius = std::max(radius, glm::distance(center, glm::vec3(p.x, p.y, p.z)) + source.radius[i]);
+        }
+        if (glm::length(normal) > 0.0f)
+        {
+            normal = glm::normalize(normal);
+        }
+        else
+        {
+            // opposing normals cancel out, fall back to any of them
+            const auto &n = source.normal[cells[begin].second];
+            normal = glm::vec3(n.x, n.y, n.z);
+        }
+
+        merged.position.push_back({center.x, center.y, center.z});
+        merged.normal.push_back({normal.x, normal.y, normal.z});
+        merged.color.push_back({static_cast<unsigned char>(color.r), static_cast<unsigned char>(color.g),
+                                static_cast<unsigned char>(color.b)});
+        if (!source.confidence.empty())
+            merged.confidence.push_back(confidence / count);
+        merged.radius.push_back(radius);
+        merged.sourceIndex.push_back(NO_SOURCE_INDEX);
+        begin = end;
+    }
+    merged.size = merged.position.size();
+    return merged;
+}
+
+static std::vector<PointCloud> buildChunkLevels(const PointCloud &pcl, const Chunk &chunk, float chunkSize)
+{
+    std::vector<PointCloud> levels;
+    auto previous = slice(pcl, chunk.levels[0].first, chunk.levels[0].count);
+    for (float cellSize = chunkSize * FINEST_LOD_CELL; cellSize <= chunkSize && previous.size > 1; cellSize *= 2.0f)
+    {
+        auto merged = mergeSplats(previous, chunk.min, cellSize);
+        if (merged.size > previous.size * MIN_LOD_REDUCTION)
+            continue;
+
+        levels.push_back(merged);
+        previous = std::move(merged);
+    }
+    return levels;
+}
+
+void buildLevelsOfDetail(PointCloud &pcl, ChunkIndex &index)
+{
+    std::vector<std::vector<PointCloud>> levels(index.chunks.size());
+    {
+        const size_t numTasks = ThreadPool::instance().concurrency();
+        std::vector<std::future<void>> tasks;
+        for (size_t t = 0; t < numTasks; t++)
+        {
+            // chunks are interleaved between the tasks, dense and sparse regions are usually clustered
+            tasks.push_back(ThreadPool::instance().submit([&, t]() {
+                for (size_t c = t; c < index.chunks.size(); c += numTasks)
+                {
+                    levels[c] = buildChunkLevels(pcl, index.chunks[c], index.chunkSize);
+                }
+            }));
+        }
+        for (auto &task : tasks)
+        {
+            ThreadPool::instance().wait(task);
+        }
+    }
+
+    const size_t numPoints = pcl.size;
+    size_t numLevels = 0;
+    for (size_t c = 0; c < index.chunks.size(); c++)
+    {
+        for (const auto &level : levels[c])
+        {
+            ChunkLevel chunkLevel;
+            chunkLevel.first = pcl.size;
+            chunkLevel.count = level.size;
+            chunkLevel.splatRadius = *std::max_element(level.radius.begin(), level.radius.end());
+            index.chunks[c].levels.push_back(chunkLevel);
+
+            pcl.position.insert(pcl.position.end(), level.position.begin(), level.position.end());
+            pcl.color.insert(pcl.color.end(), level.color.begin(), level.color.end());
+            pcl.normal.insert(pcl.normal.end(), level.normal.begin(), level.normal.end());
+            pcl.confidence.insert(pcl.confidence.end(), level.confidence.begin(), level.confidence.end());
+            pcl.radius.insert(pcl.radius.end(), level.radius.begin(), level.radius.end());
+            pcl.sourceIndex.insert(pcl.sourceIndex.end(), level.sourceIndex.begin(), level.sourceIndex.end());
+            pcl.size += level.size;
+        }
+        numLevels = std::max(numLevels, levels[c].size());
+    }
+
+    buildClusters(pcl, index);
+
+    std::cout << "\tBuilt up to " << numLevels << " levels of detail per chunk with " << pcl.size - numPoints
+              << " additional splats" << std::endl;
+}
+
+std::vector<size_t> selectLevels(const ChunkIndex &index, const std::vector<size_t> &chunks,
+                                 const glm::vec3 &cameraPosition, float focalLength, float threshold)
+{
+    std::vector<size_t> selected(chunks.size(), 0);
+    if (threshold <= 0.0f)
+        return selected;
+
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        const auto &chunk = index.chunks[chunks[i]];
+        const float distance = glm::distance(cameraPosition, glm::clamp(cameraPosition, chunk.min, chunk.max));
+        if (distance <= 0.0f)
+            continue;
+
+        // the splat radius grows with every level, the first one small enough is the coarsest
+        for (size_t level = chunk.levels.size() - 1; level > 0; level--)
+        {
+            if (2.0f * chunk.levels[level].splatRadius * focalLength / distance <= threshold)
+            {
+                selected[i] = level;
+                break;
+            }
+        }
+    }
+    return selected;
+}
+
+template <typename T>
+static void writeValue(std::ostream &stream, const T &value)
+{
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static void writeVector(std::ostream &stream, const std::vector<T> &values)
+{
+    stream.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+
+template <typename T>
+static T readValue(std::istream &stream)
+{
+    T value{};
+    stream.read(reinterpret_cast<char *>(&value), sizeof(T));
+    return value;
+}
+
+template <typename T>
+static void readVector(std::istream &stream, std::vector<T> &values, size_t size)
+{
+    values.resize(size);
+    stream.read(reinterpret_cast<char *>(values.data()), size * sizeof(T));
+}
+
+// Identifies the version of the source point cloud the hierarchy was built from
+static std::pair<uint64_t, int64_t> sourceStamp(const std::string &sourcePath)
+{
+    return {static_cast<uint64_t>(fs::file_size(sourcePath)),
+            static_cast<int64_t>(fs::last_write_time(sourcePath).time_since_epoch().count())};
+}
+
+void saveHierarchy(const std::string &path, const std::string &sourcePath, float pointSize, float chunkSize,
+                   bool mortonOrder, const PointCloud &pcl, const ChunkIndex &index)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Could not write level of detail hierarchy to " << path << std::endl;
+        return;
+    }
+
+    const auto stamp = sourceStamp(sourcePath);
+    writeValue(file, HIERARCHY_MAGIC);
+    writeValue(file, HIERARCHY_VERSION);
+    writeValue(file, stamp.first);
+    writeValue(file, stamp.second);
+    writeValue(file, pointSize);
+    writeValue(file, chunkSize);
+    writeValue(file, static_cast<uint8_t>(mortonOrder));
+
+    writeValue(file, static_cast<uint64_t>(pcl.size));
+    writeValue(file, static_cast<uint8_t>(!pcl.confidence.empty()));
+    writeVector(file, pcl.position);
+    writeVector(file, pcl.color);
+    writeVector(file, pcl.normal);
+    writeVector(file, pcl.confidence);
+    writeVector(file, pcl.radius);
+    writeVector(file, pcl.sourceIndex);
+
+    writeValue(file, index.chunkSize);
+    writeValue(file, static_cast<uint64_t>(index.chunks.size()));
+    for (const auto &chunk : index.chunks)
+    {
+        writeValue(file, chunk.min);
+        writeValue(file, chunk.max);
+        writeValue(file, static_cast<uint64_t>(chunk.levels.size()));
+        for (const auto &level : chunk.levels)
+        {
+            writeValue(file, static_cast<uint64_t>(level.first));
+            writeValue(file, static_cast<uint64_t>(level.count));
+            writeValue(file, level.splatRadius);
+        }
+    }
+
+    if (!file)
+    {
+        std::cerr << "Could not write level of detail hierarchy to " << path << std::endl;
+        return;
+    }
+    std::cout << "\tStored level of detail hierarchy in " << path << std::endl;
+}
+
+bool loadHierarchy(const std::string &path, const std::string &sourcePath, float pointSize, float chunkSize,
+                   bool mortonOrder, PointCloud &pcl, ChunkIndex &index)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+
+    const auto stamp = sourceStamp(sourcePath);
+    if (readValue<uint32_t>(file) != HIERARCHY_MAGIC || readValue<uint32_t>(file) != HIERARCHY_VERSION ||
+        readValue<uint64_t>(file) != stamp.first || readValue<int64_t>(file) != stamp.second ||
+        readValue<float>(file) != pointSize || readValue<float>(file) != chunkSize ||
+        readValue<uint8_t>(file) != static_cast<uint8_t>(mortonOrder))
+    {
+        std::cout << "\tLevel of detail hierarchy in " << path << " is outdated" << std::endl;
+        return false;
+    }
+
+    PointCloud loaded;
+    loaded.size = readValue<uint64_t>(file);
+    const bool hasConfidence = readValue<uint8_t>(file) != 0;
+    readVector(file, loaded.position, loaded.size);
+    readVector(file, loaded.color, loaded.size);
+    readVector(file, loaded.normal, loaded.size);
+    readVector(file, loaded.confidence, hasConfidence ? loaded.size : 0);
+    readVector(file, loaded.radius, loaded.size);
+    readVector(file, loaded.sourceIndex, loaded.size);
+
+    ChunkIndex loadedIndex;
+    loadedIndex.chunkSize = readValue<float>(file);
+    loadedIndex.chunks.resize(readValue<uint64_t>(file));
+    for (auto &chunk : loadedIndex.chunks)
+    {
+        chunk.min = readValue<glm::vec3>(file);
+        chunk.max = readValue<glm::vec3>(file);
+        chunk.levels.resize(readValue<uint64_t>(file));
+        for (auto &level : chunk.levels)
+        {
+            level.first = readValue<uint64_t>(file);
+            level.count = readValue<uint64_t>(file);
+            level.splatRadius = readValue<float>(file);
+            if (level.first + level.count > loaded.size)
+                return false;
+        }
+        if (chunk.levels.empty())
+            return false;
+    }
+    if (!file)
+        return false;
+
+    pcl = std::move(loaded);
+    index = std::move(loadedIndex);
+    buildClusters(pcl, index);
+
+    std::cout << "\tRead level of detail hierarchy with " << pcl.size << " splats in " << index.chunks.size()
+              << " chunks from " << path << std::endl;
+    return true;
+}
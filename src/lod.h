@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "pointcloud.h"
+#include "chunks.h"
+
+// Adds coarser levels of detail to every chunk. Each level merges the splats of the previous one
+// that fall into the same cell of a grid with twice the cell size into a single larger splat.
+// The merged splats are appended to the point cloud.
+void buildLevelsOfDetail(PointCloud &pcl, ChunkIndex &index);
+
+// Returns the coarsest level of every given chunk whose splats are at most threshold pixels wide
+// when seen from the camera position, chunks containing the camera always use the original points.
+std::vector<size_t> selectLevels(const ChunkIndex &index, const std::vector<size_t> &chunks,
+                                 const glm::vec3 &cameraPosition, float focalLength, float threshold);
+
+// Stores the reordered point cloud together with its chunks and levels of detail. The file is
+// tied to the source point cloud and the parameters the hierarchy was built with.
+void saveHierarchy(const std::string &path, const std::string &sourcePath, float pointSize, float chunkSize,
+                   bool mortonOrder, const PointCloud &pcl, const ChunkIndex &index);
+
+// Restores a hierarchy written by saveHierarchy. Returns false if the file does not exist or
+// does not match the source point cloud or parameters anymore.
+bool loadHierarchy(const std::string &path, const std::string &sourcePath, float pointSize, float chunkSize,
+                   bool mortonOrder, PointCloud &pcl, ChunkIndex &index);
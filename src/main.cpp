@@ -8,6 +8,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_access.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <tinyply.h>
@@ -18,7 +19,9 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <functional>
 #include <future>
+#include <array>
 #define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
 #include <experimental/filesystem>
 #include <pybind11/pybind11.h>
@@ -27,6 +30,20 @@
 
 #include "camera.h"
 #include "utils.h"
+#include "pointcloud.h"
+#include "chunks.h"
+#include "lod.h"
+#include "morton.h"
+#include "cpurasterizer.h"
+#include "bvh.h"
+#include "parallel.h"
+#include "simd.h"
+#include "framepool.h"
+#include "memorystats.h"
+#include "passprofiler.h"
+#include "stagetimes.h"
+#include "trace.h"
+#include "upload.h"
 #include "lodepng.h"
 #include "splat.vert.h"
 #include "ewasplat.vert.h"
@@ -36,6 +53,11 @@
 #include "splatcount.frag.h"
 #include "final.frag.h"
 #include "fullscreenquad.vert.h"
+#include "splattransform.comp.h"
+#include "hiz.comp.h"
+#include "splatbin.comp.h"
+#include "splatraster.comp.h"
+#include "splatresolve.frag.h"
 
 // Near and far clipping planes in m
 const float NEAR = 0.01f;
@@ -46,6 +68,39 @@ GLenum glCheckError_(const char *file, int line);
 
 const size_t NUM_PBOS = 3;  //triple buffering
 
+// Splat attributes are uploaded in batches of this size through a ring of staging buffers
+const size_t UPLOAD_BATCH_BYTES = size_t(16) << 20;
+const size_t NUM_STAGING_BUFFERS = 4;
+
+// Size of one transformed splat in the transform pass output (see splattransform.comp)
+const size_t SPLAT_TRANSFORM_SIZE = 12 * sizeof(float);
+
+// Shader storage bindings of the transform pass (see splattransform.comp)
+const GLuint POSITION_BINDING = 0;
+const GLuint NORMAL_BINDING = 1;
+const GLuint RADIUS_BINDING = 2;
+const GLuint COLOR_BINDING = 3;
+const GLuint SPLAT_BINDING = 4;
+const GLuint DRAW_COMMAND_BINDING = 5;
+const GLuint RANGE_BINDING = 6;
+const GLuint CLUSTER_BINDING = 7;
+const GLuint CLUSTER_VISIBILITY_BINDING = 8;
+const GLuint SPLAT_INDEX_BINDING = 9;
+const GLuint BIN_BINDING = 10;
+const GLuint FRAME_DEPTH_BINDING = 11;
+const GLuint FRAME_SPLAT_BINDING = 12;
+const GLuint DEPTH_PYRAMID_UNIT = 3;
+
+// One draw command per occlusion culling phase, without occlusion culling only the first one is used.
+// With adaptive primitives they are followed by one draw command per bin and phase (see splatbin.comp).
+const size_t NUM_CULLING_PHASES = 2;
+const size_t NUM_SPLAT_BINS = 3;
+const size_t NUM_DRAW_COMMANDS = NUM_CULLING_PHASES * (1 + NUM_SPLAT_BINS);
+
+// Segments of the full disc and of the small fan used for splats a few pixels wide
+const int DISC_FANS = 100;
+const int SMALL_DISC_FANS = 8;
+
 GLuint vao;
 GLuint vbo;
 GLuint instanceVbo;
@@ -55,6 +110,29 @@ GLuint colorVbo;
 GLuint colorPbos[NUM_PBOS];
 GLuint depthPbos[NUM_PBOS];
 GLuint program;
+GLuint transformProgram;
+GLuint splatTransformBuffer;
+GLuint drawCommandBuffer;
+GLuint visibleCountBuffer;
+GLuint rangeBuffer;
+
+// Occlusion culling specific resources
+GLuint depthPyramidProgram;
+GLuint depthPyramid;
+GLuint depthCopyTexture;
+GLuint clusterBuffer;
+GLuint clusterVisibilityBuffer;
+
+// Adaptive primitive specific resources
+GLuint binProgram;
+GLuint splatIndexBuffer;
+GLuint binBuffer;
+
+// Compute method specific resources
+GLuint rasterProgram;
+GLuint resolveProgram;
+GLuint frameDepthBuffer;
+GLuint frameSplatBuffer;
 
 // EWA specific resources
 GLuint visibilityPassProgram;
@@ -69,39 +147,297 @@ GLuint colorAccTexture;
 GLuint normalTexture;
 GLuint counterTexture;
 
-struct PointCloud
+// measurements of the last call to render with profilePasses
+std::vector<FramePassStats> lastPassStats;
+
+struct DrawArraysIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+// Contiguous range of splats processed by the transform pass (see splattransform.comp)
+struct SplatRange
+{
+    GLuint first;
+    GLuint count;
+    GLuint firstGroup;  // work groups of all previous ranges
+    GLuint cluster;     // only used with occlusion culling, the range is then a single cluster
+};
+
+// Splats the transform pass and the draws bind at once. Point clouds larger than the largest shader storage
+// block are split into several windows, every cluster belongs to exactly one of them.
+struct SplatWindow
 {
-    std::vector<float3> position;
-    std::vector<uchar3> color;
-    std::vector<float3> normal;
-    std::vector<float> confidence;
-    std::vector<float> radius;
-    size_t size;
+    size_t first;          // first splat bound from the attribute buffers
+    size_t count;
+    size_t firstSlot;      // first splat of the window in the output of the transform pass
+    size_t commandOffset;  // in bytes, every window has its own draw commands
+    // ranges of the visible clusters of the current frame
+    GLuint firstRange;
+    GLuint numRanges;
+    GLuint numGroups;
+};
+
+// Runs a function when the scope is left, also when it is left by an exception
+class ScopeExit
+{
+public:
+    explicit ScopeExit(std::function<void()> function) : function(std::move(function)) {}
+    ~ScopeExit() { run(); }
+    ScopeExit(const ScopeExit &) = delete;
+    ScopeExit &operator=(const ScopeExit &) = delete;
+
+    // runs the function now instead
+    void run()
+    {
+        if (function)
+        {
+            auto f = std::move(function);
+            function = nullptr;
+            f();
+        }
+    }
+
+private:
+    std::function<void()> function;
 };
 
 std::string readFromFile(const std::string &path);
 void writeMat(const glm::mat4 &mat);
-PointCloud readPly(const std::string &filepath, float defaultPointSize);
-
-size_t initBuffers(const PointCloud &pcl, int width, int height);
-void initShaders();
-void initEWAShaders();
+PointCloud readPly(const std::string &filepath, float defaultPointSize, bool lowMemory);
+
+std::vector<SplatWindow> splitSplatWindows(const ChunkIndex &chunks, size_t numSplats, std::vector<GLuint> &clusterWindows);
+void bindStorageRange(GLuint binding, GLuint buffer, size_t offset, size_t size);
+size_t initBuffers(PointCloud &pcl, const ChunkIndex &chunks, const std::vector<SplatWindow> &windows, int width, int height,
+                   bool releaseCloud);
+// Deletes the GL objects of a method, right before its context is destroyed. Names that were not created
+// in that context yet are either unused or belong to objects that go away with the context anyway.
+void releaseGL(const std::string &method, bool occlusionCulling, bool adaptivePrimitives);
+void enableParallelShaderCompile();
+// Program that is compiled and linked in the background, checked by finishPrograms
+struct PendingProgram
+{
+    std::string name;
+    GLuint program;
+    std::vector<GLuint> shaders;
+};
+// Starts compiling and linking the programs of a method, only finishPrograms waits for them
+std::vector<PendingProgram> compilePrograms(const std::string &method, bool occlusionCulling, bool adaptivePrimitives);
+void finishPrograms(const std::vector<PendingProgram> &programs);
 bool checkShader(GLuint shaderId, GLuint type);
 bool checkProgram(GLuint program);
 void initEWASpecificBuffers(int width, int height);
+void initFullscreenQuad();
+void initComputeRasterizer(int width, int height);
+void initOcclusionCulling(const ChunkIndex &chunks, int width, int height);
+void buildDepthPyramid(int width, int height);
+void initAdaptivePrimitives(size_t numSplats);
+void bufferData(GLenum target, size_t size, const void *data, GLenum usage, MemoryCategory category);
+void textureStorage(GLsizei levels, GLenum format, int width, int height, size_t bytesPerPixel);
 
 std::vector<float> buildCircle(int fans, float radius);
+glm::mat4 projectionMatrix(int width, int height, float fx, float fy, float cx, float cy);
+std::array<glm::vec4, 6> frustumPlanes(const glm::mat4 &clip);
+std::vector<size_t> cullScene(const ChunkIndex &chunks, const glm::mat4 &projection, const glm::mat4 &view, float nearSlack,
+                              float focalLength, float lodThreshold, bool backfaceCulling, size_t &numVisibleChunks);
 std::vector<glm::mat4> loadTrajectoryFromFile(std::string path);
+void printMemoryStats();
 
 using namespace tinyply;
 namespace py = pybind11;
 namespace fs = std::experimental::filesystem;
 
-int render(std::string pointcloudPath, std::string trajectoryPath, std::string outputPath, int delta=1, float pointSize=1e-2f,
+py::dict timingReport(const StageTimes &times);
+
+py::dict render(std::string pointcloudPath, std::string trajectoryPath, std::string outputPath, int delta=1, float pointSize=1e-2f,
     int width = 640, int height=480, float fx=528.0f, float fy=528.0f, float cx=320.0f, float cy=240.0f,
-    float depthScale=1000.0f, std::string method="standard", float surfaceThickness=0.1f)
+    float depthScale=1000.0f, std::string method="standard", float surfaceThickness=0.1f, bool backfaceCulling=false,
+    float chunkSize=1.0f, bool occlusionCulling=false, float lodThreshold=0.0f, std::string lodCache="",
+    bool mortonOrder=false, bool adaptivePrimitives=false, bool profilePasses=false, std::string timingFile="",
+    std::string traceFile="", float memoryBudget=0.0f, bool lowMemory=false)
 {
+    if (!traceFile.empty())
+    {
+#ifdef SPLAT_RENDERER_TRACING
+        startTracing();
+#else
+        std::cerr << "Tracing is not compiled in, configure with -DSPLAT_RENDERER_TRACING=ON" << std::endl;
+#endif
+    }
+    ThreadPool::instance().resetStats();
+    lastPassStats.clear();
+    auto &memory = MemoryStats::instance();
+    memory.setBudget(static_cast<size_t>(memoryBudget * 1024 * 1024));
+    memory.releaseGpu();
+    memory.resetPeaks();
+    StageTimes times;
+    const auto setupStart = std::chrono::steady_clock::now();
+    PointCloud pcl;
+    ChunkIndex chunks;
+    MemoryReservation cloudMemory(MemoryCategory::PointCloud);
+    size_t numPoints = 0;
+    std::vector<glm::mat4> trajectory;
+    // the scene and the trajectory are loaded while the context is created and the shaders compile. They get their
+    // own threads instead of pool tasks: without workers the pool runs tasks right away on this thread, before the
+    // context exists, and a queued loader could be picked up by this thread whenever it waits for pool tasks.
+    // The parallel parts of the loading still run on the pool.
+    auto sceneLoading = std::async(std::launch::async, [&]() {
+        bool cached = false;
+        {
+            // a cached hierarchy replaces the point cloud
+            StageTimer timer(times, Stage::PlyLoad);
+            cached = lodThreshold > 0.0f && !lodCache.empty() &&
+                     loadHierarchy(lodCache, pointcloudPath, pointSize, chunkSize, mortonOrder, pcl, chunks);
+            if (!cached)
+            {
+                pcl = readPly(pointcloudPath, pointSize, lowMemory);
+            }
+            cloudMemory.resize(memoryBytes(pcl));
+        }
+        if (!cached)
+        {
+            StageTimer timer(times, Stage::SceneBuild);
+            if (mortonOrder)
+            {
+                sortMorton(pcl);
+            }
+            chunks = buildChunkIndex(pcl, chunkSize);
+            if (lodThreshold > 0.0f)
+            {
+                buildLevelsOfDetail(pcl, chunks);
+                if (!lodCache.empty())
+                {
+                    saveHierarchy(lodCache, pointcloudPath, pointSize, chunkSize, mortonOrder, pcl, chunks);
+                }
+            }
+        }
+    });
+    auto trajectoryLoading = std::async(std::launch::async, [&]() {
+        StageTimer timer(times, Stage::TrajectoryLoad);
+        return loadTrajectoryFromFile(trajectoryPath);
+    });
+    auto waitForScene = [&]()
+    {
+        TRACE_ZONE("wait for scene");
+        // helps with the parallel parts of the loading meanwhile
+        auto &pool = ThreadPool::instance();
+        pool.wait(sceneLoading);
+        trajectory = pool.wait(trajectoryLoading);
+        cloudMemory.resize(memoryBytes(pcl));
+        for (const auto &chunk : chunks.chunks)
+        {
+            numPoints += chunk.levels[0].count;
+        }
+    };
+    std::vector<GLuint> visibleSplats;
+    std::vector<size_t> visibleChunks;
+    std::vector<size_t> visibleClusters;
+    std::vector<SplatRange> ranges;
+
+    auto printFrameStats = [&]()
+    {
+        for (size_t i = 0; i < times.frames().size(); i++)
+        {
+            std::ostringstream ss;
+            ss << std::setw(5) << std::setfill('0') << std::to_string(i*delta);
+            std::cout << "\t[frame " << ss.str() << "] " << visibleSplats.at(i) << " of " << numPoints << " splats in "
+                      << visibleClusters.at(i) << " of " << chunks.clusters.size() << " clusters ("
+                      << visibleChunks.at(i) << " of " << chunks.chunks.size() << " chunks) visible" << std::endl;
+        }
+        std::cout << "\tRendered " << times.frames().size() << " frames at " << times.framesPerSecond() << " fps, wrote "
+                  << times.bytesPerSecond() / (1024 * 1024) << " MB/s" << std::endl;
+    };
+
+    auto report = [&]()
+    {
+#ifdef SPLAT_RENDERER_TRACING
+        if (!traceFile.empty())
+        {
+            writeTrace(traceFile);
+        }
+#endif
+        if (!timingFile.empty())
+        {
+            times.writeJson(timingFile);
+        }
+        printMemoryStats();
+        return timingReport(times);
+    };
+
+    // frames are written while the next ones are rendered, in memory that is reused for every frame. Only
+    // created once the scene is loaded, the frames in flight are fitted into the memory left by the point cloud.
+    std::unique_ptr<FrameWriter> writer;
+    auto createFrameWriter = [&]() -> FrameWriter &
+    {
+        writer.reset(new FrameWriter(outputPath, delta, width, height, NEAR, FAR, depthScale, times));
+        std::cout << "\tFrame pool: " << writer->pool().bytes() / (1024 * 1024) << " MB on "
+                  << (writer->pool().hugePages() ? "huge pages" : "regular pages") << std::endl;
+        return *writer;
+    };
+
+    if (method == "cpu" || method == "cpu_ewa" || method == "raycast")
+    {
+        // CPU RASTERIZATION
+        // No OpenGL context is needed at all, the frames are rasterized by all cores
+        waitForScene();
+        auto &frameWriter = createFrameWriter();
+        const auto projection = projectionMatrix(width, height, fx, fy, cx, cy);
+        const float epsilon = method == "cpu_ewa" ? surfaceThickness : 0.0f;
+        SplatBVH bvh;
+        if (method == "raycast")
+        {
+            bvh = buildBVH(pcl);
+        }
+        times.add(Stage::Setup, secondsSince(setupStart));
+        times.startFrames();
+        for (int frame = 0; frame < trajectory.size(); frame += delta)
+        {
+            TRACE_ZONE("frame");
+            const auto frameStart = std::chrono::steady_clock::now();
+            const auto view = trajectory.at(frame);
+            if (method == "raycast")
+            {
+                // the rays find the visible splats themselves, nothing is culled
+                visibleChunks.push_back(chunks.chunks.size());
+                visibleClusters.push_back(chunks.clusters.size());
+                const auto buffers = frameWriter.next();
+                visibleSplats.push_back(static_cast<GLuint>(raycastSplats(pcl, bvh, view, projection, width, height,
+                                                                          backfaceCulling, buffers.color, buffers.depth)));
+                times.addFrame(secondsSince(frameStart));
+                frameWriter.write();
+                continue;
+            }
+            size_t numVisibleChunks = 0;
+            const auto visible = cullScene(chunks, projection, view, epsilon, std::max(fx, fy), lodThreshold, backfaceCulling, numVisibleChunks);
+            visibleChunks.push_back(numVisibleChunks);
+            visibleClusters.push_back(visible.size());
+
+            const auto buffers = frameWriter.next();
+            if (method == "cpu_ewa")
+            {
+                visibleSplats.push_back(static_cast<GLuint>(splatEWA(pcl, chunks, visible, view, projection, width, height,
+                                                                     backfaceCulling, surfaceThickness, buffers.color, buffers.depth)));
+            }
+            else
+            {
+                visibleSplats.push_back(static_cast<GLuint>(rasterizeSplats(pcl, chunks, visible, view, projection, width, height,
+                                                                            backfaceCulling, buffers.color, buffers.depth)));
+            }
+            times.addFrame(secondsSince(frameStart));
+            frameWriter.write();
+        }
+
+        frameWriter.finish();
+        times.stopFrames();
+        printFrameStats();
+        return report();
+    }
+
     GLFWwindow *window;
+    const auto contextStart = std::chrono::steady_clock::now();
     
     if (!glfwInit())
     {
@@ -123,71 +459,366 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
         throw std::runtime_error("Failed to create window");
     }
 
-    auto pcl = readPly(pointcloudPath, pointSize);
-    auto trajectory = loadTrajectoryFromFile(trajectoryPath);
-    std::vector<GLubyte*> rgbBuffers;
-    std::vector<float*> depthBuffers;
-
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+    // every way out of render from here on, exceptions included, deletes the GL objects and the window
+    ScopeExit teardown([&]() {
+        releaseGL(method, occlusionCulling, adaptivePrimitives);
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        memory.releaseGpu();
+    });
+    times.add(Stage::ContextCreation, secondsSince(contextStart));
 
     glEnable(GL_DEPTH_TEST);
     //glEnable(GL_CULL_FACE);
     //glCullFace(GL_BACK);
 
-    const auto pointsPerCircle = initBuffers(pcl, width, height);
+    if (adaptivePrimitives && method=="compute")
+    {
+        std::cerr << "Adaptive primitives have no effect with the compute method" << std::endl;
+        adaptivePrimitives = false;
+    }
+    // the programs compile while the scene is still loading and being uploaded, also creates the buffers that
+    // belong to the shaders and only depend on the image size
+    auto shaderStart = std::chrono::steady_clock::now();
+    enableParallelShaderCompile();
+    const auto programs = compilePrograms(method, occlusionCulling, adaptivePrimitives);
     if(method=="ewa" || method=="EWA")
     {
         initEWASpecificBuffers(width, height);
-        initEWAShaders();
-    }else{
-        initShaders();
+    }else if(method=="compute"){
+        initComputeRasterizer(width, height);
+    }
+    times.add(Stage::ShaderCompile, secondsSince(shaderStart));
+
+    waitForScene();
+    auto &frameWriter = createFrameWriter();
+    const auto uploadStart = std::chrono::steady_clock::now();
+    // the windows only depend on the clusters, so a point cloud the GPU can not take fails before the upload
+    std::vector<GLuint> clusterWindows;
+    auto windows = splitSplatWindows(chunks, pcl.size, clusterWindows);
+    const size_t numSlots = windows.back().firstSlot + windows.back().count;
+    // with low memory the GPU keeps the only copy of the point cloud
+    const auto pointsPerCircle = initBuffers(pcl, chunks, windows, width, height, lowMemory);
+    cloudMemory.resize(memoryBytes(pcl));
+    if (occlusionCulling)
+    {
+        initOcclusionCulling(chunks, width, height);
+    }
+    if (adaptivePrimitives)
+    {
+        initAdaptivePrimitives(numSlots);
     }
+    times.add(Stage::GpuUpload, secondsSince(uploadStart));
 
+    // only counts the time the programs keep the render thread waiting
+    shaderStart = std::chrono::steady_clock::now();
+    finishPrograms(programs);
+    times.add(Stage::ShaderCompile, secondsSince(shaderStart));
+    times.add(Stage::Setup, secondsSince(setupStart));
+
+    // copies the frame that was read into a pixel buffer object into the memory it is written from
+    auto readFrame = [&](size_t pbo)
+    {
+        const auto buffers = frameWriter.next();
+        StageTimer timer(times, Stage::ReadbackWait);
+        TRACE_ZONE("readback");
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, colorPbos[pbo]);
+        GLubyte* ptr;
+        {
+            TRACE_ZONE("map color PBO");
+            ptr = (GLubyte*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        }
+        if (ptr)
+        {
+            memcpy(buffers.color, ptr, 3 * width * height);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            std::cerr << "Could not map color PBO" << std::endl;
+            memset(buffers.color, 0, 3 * width * height);
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPbos[pbo]);
+        float* ptr2;
+        {
+            TRACE_ZONE("map depth PBO");
+            ptr2 = (float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        }
+        if (ptr2)
+        {
+            memcpy(buffers.depth, ptr2, width * height*sizeof(float));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            std::cerr << "Could not map depth PBO" << std::endl;
+            memset(buffers.depth, 0, width * height*sizeof(float));
+        }
+        frameWriter.write();
+    };
+
+    // the visible splats of all windows and culling phases of the frame that was read into a pixel buffer object
+    auto readVisibleSplats = [&](size_t pbo)
+    {
+        std::vector<GLuint> visibleCounts(windows.size() * NUM_CULLING_PHASES);
+        glBindBuffer(GL_COPY_READ_BUFFER, visibleCountBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, pbo * visibleCounts.size() * sizeof(GLuint), visibleCounts.size() * sizeof(GLuint),
+                           visibleCounts.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        GLuint visible = 0;
+        for (auto count : visibleCounts)
+        {
+            visible += count;
+        }
+        visibleSplats.push_back(visible);
+    };
+
+    PassProfiler profiler(profilePasses);
     size_t numDownloads = 0;
     size_t dx = 0;
+    times.startFrames();
     for (int frame = 0; frame<trajectory.size(); frame+=delta)
     {
         if(glfwWindowShouldClose(window)){
-            glfwTerminate();
-            return -1;
+            throw std::runtime_error("The window was closed");
         }
+        TRACE_ZONE("frame");
+        const auto frameStart = std::chrono::steady_clock::now();
+        profiler.beginFrame(frame);
         // render
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glm::mat4 m(0.0f);
-        m[0][0] = 2.0f * fx / width;
-        m[0][1] = 0.0f;
-        m[0][2] = 0.0f;
-        m[0][3] = 0.0f;
+        auto projection = projectionMatrix(width, height, fx, fy, cx, cy);
+        auto view = trajectory.at(frame);
+        const float epsilon = (method=="ewa" || method=="EWA") ? surfaceThickness : 0.0f;
 
-        m[1][0] = 0.0f;
-        m[1][1] = -2.0f * fy / height;
-        m[1][2] = 0.0f;
-        m[1][3] = 0.0f;
+        // CHUNK AND CLUSTER CULLING
+        // Coarse culling on the CPU, only the splats of visible clusters reach the transform pass
+        {
+            TRACE_ZONE("cullScene");
+            size_t numVisibleChunks = 0;
+            auto visible = cullScene(chunks, projection, view, epsilon, std::max(fx, fy), lodThreshold, backfaceCulling, numVisibleChunks);
+            visibleChunks.push_back(numVisibleChunks);
+            visibleClusters.push_back(visible.size());
+
+            // the ranges of every window are consecutive
+            if (windows.size() > 1)
+            {
+                std::stable_sort(visible.begin(), visible.end(), [&](size_t a, size_t b) { return clusterWindows[a] < clusterWindows[b]; });
+            }
+            ranges.clear();
+            for (auto &window : windows)
+            {
+                window.firstRange = 0;
+                window.numRanges = 0;
+                window.numGroups = 0;
+            }
+            for (auto c : visible)
+            {
+                const auto &cluster = chunks.clusters[c];
+                auto &window = windows[clusterWindows[c]];
+                if (!occlusionCulling && window.numRanges > 0 && ranges.back().first + ranges.back().count == cluster.first)
+                {
+                    // neighbouring clusters are neighbours in memory as well
+                    ranges.back().count += static_cast<GLuint>(cluster.count);
+                }
+                else
+                {
+                    if (window.numRanges == 0)
+                    {
+                        window.firstRange = static_cast<GLuint>(ranges.size());
+                    }
+                    ranges.push_back({static_cast<GLuint>(cluster.first), static_cast<GLuint>(cluster.count), 0, static_cast<GLuint>(c)});
+                    window.numRanges++;
+                }
+            }
+            for (auto &window : windows)
+            {
+                for (GLuint r = window.firstRange; r < window.firstRange + window.numRanges; r++)
+                {
+                    ranges[r].firstGroup = window.numGroups;
+                    window.numGroups += (ranges[r].count + 255) / 256;
+                }
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, rangeBuffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, ranges.size() * sizeof(SplatRange), ranges.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
 
-        m[2][0] = 1.0f - 2.0f * cx / width;
-        m[2][1] = 2.0f * cy / height - 1.0f;
-        m[2][2] = (FAR + NEAR) / (NEAR - FAR);
-        m[2][3] = -1.0f;
+        // TRANSFORM PASS
+        // Transforms and culls all splats once per frame and compacts the visible ones for the indirect draws.
+        // With occlusion culling it runs twice, first for the clusters visible in the last frame and then for
+        // the remaining clusters that are not hidden behind the depth of the first phase.
+        std::array<DrawArraysIndirectCommand, NUM_DRAW_COMMANDS> drawCommands;
+        drawCommands.fill({static_cast<GLuint>(pointsPerCircle), 0, 0, 0});
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
+        for (const auto &window : windows)
+        {
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, window.commandOffset, sizeof(drawCommands), drawCommands.data());
+        }
 
-        m[3][0] = 0.0f;
-        m[3][1] = 0.0f;
-        m[3][2] = 2.0f * FAR * NEAR / (NEAR - FAR);
-        m[3][3] = 0.0f;
+        // the transformed splats, their draw commands and the splats sorted by bin of one window
+        auto bindWindow = [&](const SplatWindow &window)
+        {
+            bindStorageRange(SPLAT_BINDING, splatTransformBuffer, window.firstSlot * SPLAT_TRANSFORM_SIZE, window.count * SPLAT_TRANSFORM_SIZE);
+            bindStorageRange(DRAW_COMMAND_BINDING, drawCommandBuffer, window.commandOffset, sizeof(drawCommands));
+            if (adaptivePrimitives)
+            {
+                bindStorageRange(SPLAT_INDEX_BINDING, splatIndexBuffer, window.firstSlot * sizeof(GLuint), window.count * sizeof(GLuint));
+            }
+        };
 
-        auto projection = m;
-        auto view = trajectory.at(frame);
+        auto transformPass = [&](int cullingPhase)
+        {
+            TRACE_ZONE("transform pass");
+            glUseProgram(transformProgram);
+            auto modelviewLoc = glGetUniformLocation(transformProgram, "modelview");
+            glUniformMatrix4fv(modelviewLoc, 1, GL_FALSE, glm::value_ptr(view[0]));
+            auto projectionLoc = glGetUniformLocation(transformProgram, "projection");
+            glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection[0]));
+            auto planes = frustumPlanes(projection);
+            auto planesLoc = glGetUniformLocation(transformProgram, "frustumPlanes");
+            glUniform4fv(planesLoc, static_cast<GLsizei>(planes.size()), glm::value_ptr(planes[0]));
+            auto epsilonLoc = glGetUniformLocation(transformProgram, "epsilon");
+            glUniform1f(epsilonLoc, epsilon);
+            auto backfaceCullingLoc = glGetUniformLocation(transformProgram, "backfaceCulling");
+            glUniform1i(backfaceCullingLoc, backfaceCulling);
+            auto cullingPhaseLoc = glGetUniformLocation(transformProgram, "cullingPhase");
+            glUniform1i(cullingPhaseLoc, cullingPhase);
+            auto drawIndexLoc = glGetUniformLocation(transformProgram, "drawIndex");
+            glUniform1ui(drawIndexLoc, cullingPhase == 2 ? 1 : 0);
+            auto binningLoc = glGetUniformLocation(transformProgram, "binning");
+            glUniform1i(binningLoc, adaptivePrimitives);
+            auto pixelScaleLoc = glGetUniformLocation(transformProgram, "pixelScale");
+            glUniform1f(pixelScaleLoc, std::max(fx, fy));
+            auto firstRangeLoc = glGetUniformLocation(transformProgram, "firstRange");
+            auto numRangesLoc = glGetUniformLocation(transformProgram, "numRanges");
+            auto firstSplatLoc = glGetUniformLocation(transformProgram, "firstSplat");
+
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RANGE_BINDING, rangeBuffer);
+            if (occlusionCulling)
+            {
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_BINDING, clusterBuffer);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_VISIBILITY_BINDING, clusterVisibilityBuffer);
+                glActiveTexture(GL_TEXTURE0 + DEPTH_PYRAMID_UNIT);
+                glBindTexture(GL_TEXTURE_2D, depthPyramid);
+                glActiveTexture(GL_TEXTURE0);
+            }
+
+            for (const auto &window : windows)
+            {
+                glUseProgram(transformProgram);
+                glUniform1ui(firstRangeLoc, window.firstRange);
+                glUniform1ui(numRangesLoc, window.numRanges);
+                glUniform1ui(firstSplatLoc, static_cast<GLuint>(window.first));
+                bindStorageRange(POSITION_BINDING, instanceVbo, window.first * sizeof(float3), window.count * sizeof(float3));
+                bindStorageRange(NORMAL_BINDING, normalVbo, window.first * sizeof(float3), window.count * sizeof(float3));
+                bindStorageRange(RADIUS_BINDING, radiusVbo, window.first * sizeof(float), window.count * sizeof(float));
+                // the windows start at aligned splats, so only the size has to be padded to whole words
+                bindStorageRange(COLOR_BINDING, colorVbo, window.first * sizeof(uchar3), (window.count * sizeof(uchar3) + 3) / 4 * 4);
+                bindWindow(window);
+                if (adaptivePrimitives)
+                {
+                    const std::array<GLuint, 3 * NUM_SPLAT_BINS> zeros{};
+                    glBindBuffer(GL_SHADER_STORAGE_BUFFER, binBuffer);
+                    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros.data());
+                    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+                    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BIN_BINDING, binBuffer);
+                }
+
+                // large point clouds exceed the maximum number of work groups in x
+                if (window.numGroups > 0)
+                {
+                    const GLuint groupsX = std::min<GLuint>(window.numGroups, 65535);
+                    glDispatchCompute(groupsX, (window.numGroups + groupsX - 1) / groupsX, 1);
+                }
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+                glCheckError();
+
+                // ADAPTIVE PRIMITIVES
+                // Sorts the splats into points, small fans and full discs by their size on screen,
+                // every bin gets its own draw command
+                if (adaptivePrimitives)
+                {
+                    const GLuint phase = cullingPhase == 2 ? 1 : 0;
+                    const std::array<GLuint, NUM_SPLAT_BINS> binFirst = {0, DISC_FANS + 2, 0};
+                    const std::array<GLuint, NUM_SPLAT_BINS> binCount = {1, SMALL_DISC_FANS + 2, DISC_FANS + 2};
+                    glUseProgram(binProgram);
+                    glUniform1ui(glGetUniformLocation(binProgram, "phase"), phase);
+                    glUniform1f(glGetUniformLocation(binProgram, "pixelScale"), std::max(fx, fy));
+                    glUniform1uiv(glGetUniformLocation(binProgram, "binFirst"), static_cast<GLsizei>(binFirst.size()), binFirst.data());
+                    glUniform1uiv(glGetUniformLocation(binProgram, "binCount"), static_cast<GLsizei>(binCount.size()), binCount.data());
+
+                    auto stageLoc = glGetUniformLocation(binProgram, "stage");
+                    glUniform1i(stageLoc, 0);
+                    glDispatchCompute(1, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+                    glUniform1i(stageLoc, 1);
+                    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, binBuffer);
+                    glDispatchComputeIndirect(2 * NUM_SPLAT_BINS * sizeof(GLuint));
+                    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+                    glCheckError();
+                }
+            }
+        };
+
+        // OCCLUSION CULLING
+        // The depth left behind by the first phase decides which of the remaining clusters are drawn at all,
+        // their splats are appended behind those of the first phase
+        auto occlusionPass = [&]()
+        {
+            TRACE_ZONE("occlusion pass");
+            profiler.begin(RenderPass::Occlusion);
+            buildDepthPyramid(width, height);
+            for (const auto &window : windows)
+            {
+                glCopyBufferSubData(GL_DRAW_INDIRECT_BUFFER, GL_DRAW_INDIRECT_BUFFER,
+                                    window.commandOffset + offsetof(DrawArraysIndirectCommand, instanceCount),
+                                    window.commandOffset + sizeof(DrawArraysIndirectCommand) + offsetof(DrawArraysIndirectCommand, baseInstance),
+                                    sizeof(GLuint));
+            }
+            transformPass(2);
+        };
+
+        auto drawSplats = [&](GLuint shaderProgram, GLuint phase)
+        {
+            auto drawIndexLoc = glGetUniformLocation(shaderProgram, "drawIndex");
+            glUniform1i(glGetUniformLocation(shaderProgram, "binned"), adaptivePrimitives);
+            for (const auto &window : windows)
+            {
+                bindWindow(window);
+                if (!adaptivePrimitives)
+                {
+                    glUniform1ui(drawIndexLoc, phase);
+                    glDrawArraysIndirect(GL_TRIANGLE_FAN, reinterpret_cast<const void *>(window.commandOffset + phase * sizeof(DrawArraysIndirectCommand)));
+                    continue;
+                }
+                for (GLuint bin = 0; bin < NUM_SPLAT_BINS; bin++)
+                {
+                    const GLuint drawIndex = NUM_CULLING_PHASES + phase * NUM_SPLAT_BINS + bin;
+                    glUniform1ui(drawIndexLoc, drawIndex);
+                    glDrawArraysIndirect(bin == 0 ? GL_POINTS : GL_TRIANGLE_FAN,
+                                         reinterpret_cast<const void *>(window.commandOffset + drawIndex * sizeof(DrawArraysIndirectCommand)));
+                }
+            }
+        };
+
+        profiler.begin(RenderPass::Transform);
+        transformPass(occlusionCulling ? 1 : 0);
 
         if(method=="ewa" || method=="EWA")
         {   
             // VISIBILITY PASS
             {
+                TRACE_ZONE("visibility pass");
+                profiler.begin(RenderPass::Visibility);
                 glEnable(GL_DEPTH_TEST);
                 glDepthMask(GL_TRUE);
                 glUseProgram(visibilityPassProgram);
-                auto modelviewLoc = glGetUniformLocation(visibilityPassProgram, "modelview");
-                glUniformMatrix4fv(modelviewLoc, 1, GL_FALSE, glm::value_ptr(view[0]));
                 auto projectionLoc = glGetUniformLocation(visibilityPassProgram, "projection");
                 glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection[0]));
                 auto epsilonLoc = glGetUniformLocation(visibilityPassProgram, "epsilon");
@@ -198,15 +829,22 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
                 glDrawBuffer(GL_COLOR_ATTACHMENT0);
                 glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
                 glBindVertexArray(vao);
-                glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, pointsPerCircle, pcl.size);
+                drawSplats(visibilityPassProgram, 0);
+                if (occlusionCulling)
+                {
+                    occlusionPass();
+                    profiler.begin(RenderPass::Visibility);
+                    glUseProgram(visibilityPassProgram);
+                    drawSplats(visibilityPassProgram, 1);
+                }
                 glCheckError();
             }
 
             // ACCUMULATION PASS
             {
+                TRACE_ZONE("accumulation pass");
+                profiler.begin(RenderPass::Accumulation);
                 glUseProgram(splatcountProgram);
-                auto modelviewLoc = glGetUniformLocation(splatcountProgram, "modelview");
-                glUniformMatrix4fv(modelviewLoc, 1, GL_FALSE, glm::value_ptr(view[0]));
                 auto projectionLoc = glGetUniformLocation(splatcountProgram, "projection");
                 glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection[0]));
                 glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
@@ -216,7 +854,11 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
                 glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE);
                 GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
                 glDrawBuffers(3, drawBuffers);
-                glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, pointsPerCircle, pcl.size);
+                drawSplats(splatcountProgram, 0);
+                if (occlusionCulling)
+                {
+                    drawSplats(splatcountProgram, 1);
+                }
                 glDisable(GL_BLEND);
                 glDepthMask(GL_TRUE);
                 glCheckError();
@@ -224,6 +866,8 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
 
             // INTERPOLATION PASS
             {
+                TRACE_ZONE("interpolation pass");
+                profiler.begin(RenderPass::Interpolation);
                 glUseProgram(finalPassProgram);
                 auto nearLoc = glGetUniformLocation(finalPassProgram, "near");
                 glUniform1f(nearLoc, NEAR);
@@ -254,52 +898,122 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
                 glDepthFunc(GL_LESS);
                 glDisable(GL_DEPTH_TEST);
             }
+        }else if(method=="compute"){
+            // SOFTWARE RASTERIZATION
+            // Splats are rasterized into shader storage instead of the framebuffer, the resolve pass then
+            // writes color and depth of the closest splat of every pixel like the standard method would
+            const auto inverseProjection = glm::inverse(projection);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FRAME_DEPTH_BINDING, frameDepthBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FRAME_SPLAT_BINDING, frameSplatBuffer);
+            const GLuint farthest = 0x3f800000;  // 1.0f
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, frameDepthBuffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &farthest);
+
+            auto rasterize = [&](GLuint phase)
+            {
+                TRACE_ZONE("rasterization pass");
+                profiler.begin(RenderPass::Rasterization);
+                glUseProgram(rasterProgram);
+                glUniformMatrix4fv(glGetUniformLocation(rasterProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection[0]));
+                glUniformMatrix4fv(glGetUniformLocation(rasterProgram, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection[0]));
+                glUniform2i(glGetUniformLocation(rasterProgram, "viewport"), width, height);
+                glUniform1ui(glGetUniformLocation(rasterProgram, "phase"), phase);
+
+                // the splat pass covers the splats of all phases, as a later phase may hide pixels of an earlier one
+                const GLuint noSplat = 0xffffffff;
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, frameSplatBuffer);
+                glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &noSplat);
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+                // the depth of all windows is known before any of them looks for its splats
+                auto rasterPassLoc = glGetUniformLocation(rasterProgram, "rasterPass");
+                auto firstSlotLoc = glGetUniformLocation(rasterProgram, "firstSlot");
+                for (int rasterPass = 0; rasterPass < 2; rasterPass++)
+                {
+                    glUniform1i(rasterPassLoc, rasterPass);
+                    for (const auto &window : windows)
+                    {
+                        glUniform1ui(firstSlotLoc, static_cast<GLuint>(window.firstSlot));
+                        bindWindow(window);
+                        if (window.numGroups > 0)
+                        {
+                            const GLuint groupsX = std::min<GLuint>(window.numGroups, 65535);
+                            glDispatchCompute(groupsX, (window.numGroups + groupsX - 1) / groupsX, 1);
+                        }
+                    }
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                }
+
+                glUseProgram(resolveProgram);
+                glUniformMatrix4fv(glGetUniformLocation(resolveProgram, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection[0]));
+                glUniform2i(glGetUniformLocation(resolveProgram, "viewport"), width, height);
+                glEnable(GL_DEPTH_TEST);
+                glDepthFunc(GL_ALWAYS);
+                glBindVertexArray(quadVao);
+                for (const auto &window : windows)
+                {
+                    glUniform1ui(glGetUniformLocation(resolveProgram, "firstSlot"), static_cast<GLuint>(window.firstSlot));
+                    glUniform1ui(glGetUniformLocation(resolveProgram, "numSlots"), static_cast<GLuint>(window.count));
+                    bindWindow(window);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                }
+                glDepthFunc(GL_LESS);
+                glCheckError();
+            };
+
+            rasterize(0);
+            if (occlusionCulling)
+            {
+                occlusionPass();
+                rasterize(1);
+            }
         }else{
+            TRACE_ZONE("draw pass");
+            profiler.begin(RenderPass::Draw);
             glUseProgram(program);
             glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection[0]));
-            glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view[0]));
 
             glBindVertexArray(vao);
-            glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, pointsPerCircle, pcl.size);
+            drawSplats(program, 0);
+            if (occlusionCulling)
+            {
+                occlusionPass();
+                profiler.begin(RenderPass::Draw);
+                glUseProgram(program);
+                drawSplats(program, 1);
+            }
         }
-        if (numDownloads < NUM_PBOS)
+        profiler.end();
+        if (numDownloads >= NUM_PBOS)
         {
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, colorPbos[dx]);
-            glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPbos[dx]);
-            glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+            readVisibleSplats(dx);
         }
-        else
+        // keep the visible splat counts alongside the pixels until the frame is downloaded
+        glBindBuffer(GL_COPY_WRITE_BUFFER, visibleCountBuffer);
+        for (size_t w = 0; w < windows.size(); w++)
         {
-            glBindBuffer(GL_PIXEL_PACK_BUFFER, colorPbos[dx]);
-            GLubyte* ptr = (GLubyte*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-            if (ptr)
+            for (size_t d = 0; d < NUM_CULLING_PHASES; d++)
             {
-                GLubyte* cpuBuffer = new GLubyte[3*width*height];
-                memcpy(cpuBuffer, ptr, 3 * width * height);
-                rgbBuffers.push_back(cpuBuffer);
-                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                glCopyBufferSubData(GL_DRAW_INDIRECT_BUFFER, GL_COPY_WRITE_BUFFER,
+                                    windows[w].commandOffset + d * sizeof(DrawArraysIndirectCommand) + offsetof(DrawArraysIndirectCommand, instanceCount),
+                                    ((dx * windows.size() + w) * NUM_CULLING_PHASES + d) * sizeof(GLuint), sizeof(GLuint));
             }
-            else
-            {
-                std::cerr << "Could not map color PBO" << std::endl;
-            }
-            glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        times.addFrame(secondsSince(frameStart));
 
+        if (numDownloads >= NUM_PBOS)
+        {
+            readFrame(dx);
+        }
+        {
+            TRACE_ZONE("readPixels");
+            profiler.begin(RenderPass::Readback);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, colorPbos[dx]);
+            glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
             glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPbos[dx]);
-            float* ptr2 = (float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-            if (ptr2)
-            {
-                float* cpuBuffer = new float[width * height];
-                memcpy(cpuBuffer, ptr2, width * height*sizeof(float));
-                depthBuffers.push_back(cpuBuffer);
-                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-            }
-            else
-            {
-                std::cerr << "Could not map depth PBO" << std::endl;
-            }
             glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+            profiler.end();
         }
 
         dx = (dx + 1) % NUM_PBOS;
@@ -307,106 +1021,89 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
         // swap buffers and poll IO events
+        TRACE_ZONE("swap buffers");
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
-    // read remaining pbos
-    for(int pbo = 0; pbo < NUM_PBOS; pbo++)
-    {
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, colorPbos[dx]);
-        GLubyte* ptr = (GLubyte*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-        if (ptr)
-        {
-            GLubyte* cpuBuffer = new GLubyte[3*width*height];
-            memcpy(cpuBuffer, ptr, 3 * width * height);
-            rgbBuffers.push_back(cpuBuffer);
-            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-        }
-        else
-        {
-            std::cerr << "Could not map color PBO" << std::endl;
-        }
-        glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    profiler.finish();
 
-        glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPbos[dx]);
-        float* ptr2 = (float*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
-        if (ptr2)
-        {
-            float* cpuBuffer = new float[width * height];
-            memcpy(cpuBuffer, ptr2, width * height*sizeof(float));
-            depthBuffers.push_back(cpuBuffer);
-            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-        }
-        else
-        {
-            std::cerr << "Could not map depth PBO" << std::endl;
-        }
+    // read remaining pbos, oldest first, with fewer frames than pbos some of them were never written
+    const size_t pending = std::min(numDownloads, NUM_PBOS);
+    dx = (dx + NUM_PBOS - pending) % NUM_PBOS;
+    for (size_t pbo = 0; pbo < pending; pbo++)
+    {
+        readVisibleSplats(dx);
+        readFrame(dx);
         dx = (dx + 1) % NUM_PBOS;
         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
     }
     
-    for (int i = 0; i < rgbBuffers.size(); i++) {
-        fs::create_directories(outputPath + "/debug");
-        fs::create_directories(outputPath + "/depth");
-        std::ostringstream ss;
-        ss << std::setw(5) << std::setfill('0') << std::to_string(i*delta);
-        auto fileNameColor = outputPath + "/debug/" + ss.str() + ".png";
-        auto fileNameDepth = outputPath + "/depth/" + ss.str() + ".png";
-        std::async(std::launch::async, [&]() {
-            // flip image
-            GLubyte* tmpColor = new GLubyte[width * height * 3];
-            for (int row = 0; row < height; row++)
-            {
-                memcpy(&tmpColor[row * width * 3], &rgbBuffers.at(i)[(height - row-1) * width * 3], width*3);
-            }
-            lodepng::encode(fileNameColor, tmpColor, width, height, LCT_RGB, 8U);
-            delete[] tmpColor;
-
-            float* tmpDepth = new float[width * height];
-            unsigned char* tmpDepthBytes = new unsigned char[width * height * 2];
-            for (int row = 0; row < height; row++)
-            {
-                memcpy(&tmpDepth[row * width], &depthBuffers.at(i)[(height - row - 1) * width], width * sizeof(float));
-            }
-            for (int j = 0; j < width * height; j++)
+    frameWriter.finish();
+    times.stopFrames();
+    printFrameStats();
+    if (profilePasses)
+    {
+        const auto total = profiler.total();
+        for (size_t p = 0; p < NUM_RENDER_PASSES; p++)
+        {
+            if (total[p].measured)
             {
-                float d = tmpDepth[j];
-                if (d > 0.0f && d < 1.0f)
-                {
-                    d = (2.0f * d) - 1.0f;
-                    d = (2.0f * NEAR * FAR) / (FAR + NEAR - (d*(FAR - NEAR)));
-                }
-                else
-                {
-                    d = 0.0f;
-                }
-                // d is not in meters so convert it to mm
-                d *= depthScale;
-                // we do not have sub milimeter accuracy so we can savely convert d to uint16_t
-                uint16_t bytes = d;
-                unsigned char lsb = bytes & 0xff;
-                unsigned char msb = bytes >> 8;
-                tmpDepthBytes[2*j + 0] = msb;
-                tmpDepthBytes[2*j + 1] = lsb;
+                std::cout << "\t" << renderPassName(static_cast<RenderPass>(p)) << " pass: "
+                          << total[p].milliseconds / profiler.frames().size() << " ms per frame" << std::endl;
             }
-            lodepng::encode(fileNameDepth, tmpDepthBytes, width, height, LCT_GREY, 16U);
-            delete[] tmpDepth;
-            delete[] tmpDepthBytes;
-            }
-        );
+        }
+        profiler.writeCsv(outputPath + "/pass_stats.csv");
+        lastPassStats = profiler.frames();
     }
 
+    teardown.run();
+
+    return report();
+}
+
+void releaseGL(const std::string &method, bool occlusionCulling, bool adaptivePrimitives)
+{
     glDeleteProgram(program);
+    glDeleteProgram(transformProgram);
     glDeleteBuffers(1, &vbo);
     glDeleteBuffers(1, &instanceVbo);
     glDeleteBuffers(1, &radiusVbo);
     glDeleteBuffers(1, &colorVbo);
     glDeleteBuffers(1, &normalVbo);
+    glDeleteBuffers(1, &splatTransformBuffer);
+    glDeleteBuffers(1, &drawCommandBuffer);
+    glDeleteBuffers(1, &visibleCountBuffer);
+    glDeleteBuffers(1, &rangeBuffer);
     glDeleteBuffers(NUM_PBOS, colorPbos);
     glDeleteBuffers(NUM_PBOS, depthPbos);
     glDeleteVertexArrays(1, &vao);
 
+    if (occlusionCulling)
+    {
+        glDeleteProgram(depthPyramidProgram);
+        glDeleteTextures(1, &depthPyramid);
+        glDeleteTextures(1, &depthCopyTexture);
+        glDeleteBuffers(1, &clusterBuffer);
+        glDeleteBuffers(1, &clusterVisibilityBuffer);
+    }
+
+    if (adaptivePrimitives)
+    {
+        glDeleteProgram(binProgram);
+        glDeleteBuffers(1, &splatIndexBuffer);
+        glDeleteBuffers(1, &binBuffer);
+    }
+
+    if(method == "compute"){
+        glDeleteProgram(rasterProgram);
+        glDeleteProgram(resolveProgram);
+        glDeleteBuffers(1, &frameDepthBuffer);
+        glDeleteBuffers(1, &frameSplatBuffer);
+        glDeleteBuffers(1, &quadVbo);
+        glDeleteVertexArrays(1, &quadVao);
+    }
+
     if(method == "ewa" || method == "EWA"){
         glDeleteProgram(finalPassProgram);
         glDeleteProgram(visibilityPassProgram);
@@ -421,20 +1118,6 @@ int render(std::string pointcloudPath, std::string trajectoryPath, std::string o
         glDeleteRenderbuffers(1, &depthBuffer);
         glDeleteFramebuffers(1, &fbo);
     }
-
-    glfwTerminate();
-
-    for (auto& buffer : rgbBuffers)
-    {
-        delete[] buffer;
-    }
-
-    for (auto& buffer : depthBuffers)
-    {
-        delete[] buffer;
-    }
-
-    return 0;
 }
 
 std::string readFromFile(const std::string &path)
@@ -458,55 +1141,178 @@ std::string readFromFile(const std::string &path)
     return content;
 }
 
-size_t initBuffers(const PointCloud &pcl, int width, int height)
+void bufferData(GLenum target, size_t size, const void *data, GLenum usage, MemoryCategory category)
 {
-    auto circle = buildCircle(100, 1.0f);
+    glBufferData(target, size, data, usage);
+    MemoryStats::instance().add(category, size);
+}
 
-    size_t num_points = circle.size();
+// Allocates all levels of the bound 2D texture
+void textureStorage(GLsizei levels, GLenum format, int width, int height, size_t bytesPerPixel)
+{
+    glTexStorage2D(GL_TEXTURE_2D, levels, format, width, height);
+    size_t bytes = 0;
+    for (GLsizei level = 0; level < levels; level++)
+    {
+        bytes += size_t(std::max(width >> level, 1)) * std::max(height >> level, 1) * bytesPerPixel;
+    }
+    MemoryStats::instance().add(MemoryCategory::GpuTextures, bytes);
+}
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, circle.size() * sizeof(float), circle.data(), GL_STATIC_DRAW);
+// Adds a buffer of size bytes with the values at its start to the upload. With releaseHost the values are
+// freed right after their upload.
+template <typename T>
+GLuint uploadAttribute(StagingUpload &upload, std::vector<T> &values, size_t size, bool releaseHost)
+{
+    std::function<void()> release;
+    if (releaseHost)
+    {
+        release = [&values]() { std::vector<T>().swap(values); };
+    }
+    return upload.add(values.data(), values.size() * sizeof(T), size, release);
+}
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
+std::vector<SplatWindow> splitSplatWindows(const ChunkIndex &chunks, size_t numSplats, std::vector<GLuint> &clusterWindows)
+{
+    GLint maxStorageBlockSize;
+    glGetIntegerv(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxStorageBlockSize);
+    GLint offsetAlignment;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+    // the transformed splats take the most space per splat, offsets that are a multiple of the alignment in
+    // splats are aligned for every attribute, the three bytes of the colors included
+    const size_t maxSplats = static_cast<size_t>(maxStorageBlockSize) / SPLAT_TRANSFORM_SIZE;
+    const size_t alignment = std::max<size_t>(offsetAlignment, sizeof(GLuint));
+    const size_t commandStride = (NUM_DRAW_COMMANDS * sizeof(DrawArraysIndirectCommand) + alignment - 1) / alignment * alignment;
+
+    // the clusters of the coarser levels of detail follow all original points
+    std::vector<size_t> order(chunks.clusters.size());
+    for (size_t c = 0; c < order.size(); c++)
+    {
+        order[c] = c;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return chunks.clusters[a].first < chunks.clusters[b].first; });
 
-    glGenBuffers(1, &instanceVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
-    glBufferData(GL_ARRAY_BUFFER, pcl.position.size() * sizeof(float3), pcl.position.data(), GL_STATIC_DRAW);
+    std::vector<SplatWindow> windows;
+    clusterWindows.assign(chunks.clusters.size(), 0);
+    size_t next = 0;
+    do
+    {
+        SplatWindow window{};
+        window.first = next < order.size() ? chunks.clusters[order[next]].first / alignment * alignment : 0;
+        size_t end = window.first;
+        while (next < order.size())
+        {
+            const auto &cluster = chunks.clusters[order[next]];
+            if (cluster.first + cluster.count - window.first > maxSplats)
+            {
+                break;
+            }
+            end = cluster.first + cluster.count;
+            clusterWindows[order[next]] = static_cast<GLuint>(windows.size());
+            next++;
+        }
+        if (next < order.size() && end == window.first)
+        {
+            throw std::runtime_error("Shader storage blocks are too small for a single cluster");
+        }
+        // a single window covers all splats, like a single binding of the whole buffers
+        window.count = windows.empty() && next == order.size() ? numSplats : end - window.first;
+        if (!windows.empty())
+        {
+            const auto &previous = windows.back();
+            window.firstSlot = (previous.firstSlot + previous.count + alignment - 1) / alignment * alignment;
+        }
+        window.commandOffset = windows.size() * commandStride;
+        windows.push_back(window);
+    } while (next < order.size());
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribDivisor(1, 1);
+    if (windows.size() > 1)
+    {
+        std::cout << "\tsplit " << numSplats << " splats into " << windows.size() << " windows of at most "
+                  << maxSplats << " splats" << std::endl;
+    }
+    return windows;
+}
 
-    glGenBuffers(1, &radiusVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, radiusVbo);
-    glBufferData(GL_ARRAY_BUFFER, pcl.radius.size() * sizeof(float), pcl.radius.data(), GL_STATIC_DRAW);
+void bindStorageRange(GLuint binding, GLuint buffer, size_t offset, size_t size)
+{
+    // empty ranges are invalid, an empty point cloud binds its empty buffers as a whole
+    if (size == 0)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+        return;
+    }
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(size));
+}
 
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)0);
-    glEnableVertexAttribArray(2);
-    glVertexAttribDivisor(2, 1);
+size_t initBuffers(PointCloud &pcl, const ChunkIndex &chunks, const std::vector<SplatWindow> &windows, int width, int height,
+                   bool releaseCloud)
+{
+    auto circle = buildCircle(DISC_FANS, 1.0f);
 
-    glGenBuffers(1, &colorVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, colorVbo);
-    glBufferData(GL_ARRAY_BUFFER, pcl.color.size() * sizeof(uchar3), pcl.color.data(), GL_STATIC_DRAW);
+    size_t num_points = circle.size() / 3;
 
-    glVertexAttribPointer(3, 3, GL_UNSIGNED_BYTE, GL_TRUE, 3 * sizeof(unsigned char), (void *)0);
-    glEnableVertexAttribArray(3);
-    glVertexAttribDivisor(3, 1);
+    // the small fan circumscribes the disc, so that it covers the same pixels
+    auto smallCircle = buildCircle(SMALL_DISC_FANS, 1.0f / static_cast<float>(cos(M_PI / SMALL_DISC_FANS)));
+    circle.insert(circle.end(), smallCircle.begin(), smallCircle.end());
 
-    glGenBuffers(1, &normalVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, normalVbo);
-    glBufferData(GL_ARRAY_BUFFER, pcl.normal.size() * sizeof(float3), pcl.normal.data(), GL_STATIC_DRAW);
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    bufferData(GL_ARRAY_BUFFER, circle.size() * sizeof(float), circle.data(), GL_STATIC_DRAW, MemoryCategory::GpuVertexBuffers);
 
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_TRUE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(4);
-    glVertexAttribDivisor(4, 1);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
 
     glBindVertexArray(0);
 
+    // The per splat attributes are only read by the transform pass, which accesses them as shader storage.
+    // Workers copy them into the staging buffers while the GPU copies the previous batches into place.
+    {
+        TRACE_ZONE("upload splats");
+        StagingUpload upload(UPLOAD_BATCH_BYTES, NUM_STAGING_BUFFERS);
+        instanceVbo = uploadAttribute(upload, pcl.position, pcl.size * sizeof(float3), releaseCloud);
+        radiusVbo = uploadAttribute(upload, pcl.radius, pcl.size * sizeof(float), releaseCloud);
+        // colors are read as 32 bit words, so the size has to be padded to a multiple of 4 bytes
+        colorVbo = uploadAttribute(upload, pcl.color, (pcl.size * sizeof(uchar3) + 3) / 4 * 4, releaseCloud);
+        normalVbo = uploadAttribute(upload, pcl.normal, pcl.size * sizeof(float3), releaseCloud);
+        upload.finish();
+    }
+    if (releaseCloud)
+    {
+        // pcl.size stays, the renderer still needs the number of splats
+        std::vector<float>().swap(pcl.confidence);
+        std::vector<uint32_t>().swap(pcl.sourceIndex);
+    }
+
+    // Output of the transform pass, holds the visible splats of the current frame
+    const size_t numSlots = windows.back().firstSlot + windows.back().count;
+    glGenBuffers(1, &splatTransformBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, splatTransformBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, numSlots * SPLAT_TRANSFORM_SIZE, nullptr, GL_DYNAMIC_COPY, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // The transform pass counts the visible splats directly into the draw commands of every window
+    glGenBuffers(1, &drawCommandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommandBuffer);
+    bufferData(GL_DRAW_INDIRECT_BUFFER, windows.back().commandOffset + NUM_DRAW_COMMANDS * sizeof(DrawArraysIndirectCommand), nullptr,
+               GL_DYNAMIC_DRAW, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // Splat ranges of the visible clusters, at most one per cluster
+    glGenBuffers(1, &rangeBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, rangeBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(chunks.clusters.size(), 1) * sizeof(SplatRange), nullptr, GL_STREAM_DRAW, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Visible splat counts travel with the pbos, so reading them back never stalls
+    std::vector<GLuint> zeros(NUM_PBOS * windows.size() * NUM_CULLING_PHASES, 0);
+    glGenBuffers(1, &visibleCountBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, visibleCountBuffer);
+    bufferData(GL_COPY_WRITE_BUFFER, zeros.size() * sizeof(GLuint), zeros.data(), GL_STREAM_READ, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
     // Set up pbos for efficient pixel transfers
     glGenBuffers(NUM_PBOS, colorPbos);
     glGenBuffers(NUM_PBOS, depthPbos);
@@ -514,35 +1320,119 @@ size_t initBuffers(const PointCloud &pcl, int width, int height)
     for (int i = 0; i < NUM_PBOS; i++)
     {
         glBindBuffer(GL_PIXEL_PACK_BUFFER, colorPbos[i]);
-        glBufferData(GL_PIXEL_PACK_BUFFER, nbytes, nullptr, GL_STREAM_READ);
+        bufferData(GL_PIXEL_PACK_BUFFER, nbytes, nullptr, GL_STREAM_READ, MemoryCategory::GpuPixelBuffers);
         glBindBuffer(GL_PIXEL_PACK_BUFFER, depthPbos[i]);
-        glBufferData(GL_PIXEL_PACK_BUFFER, width*height*sizeof(float), nullptr, GL_STREAM_READ);
+        bufferData(GL_PIXEL_PACK_BUFFER, width*height*sizeof(float), nullptr, GL_STREAM_READ, MemoryCategory::GpuPixelBuffers);
     }
     glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
     return num_points;
 }
 
+void initOcclusionCulling(const ChunkIndex &chunks, int width, int height)
+{
+    // Copy of the depth buffer after the first phase, the default framebuffer can not be sampled directly
+    glGenTextures(1, &depthCopyTexture);
+    glBindTexture(GL_TEXTURE_2D, depthCopyTexture);
+    textureStorage(1, GL_DEPTH_COMPONENT32F, width, height, sizeof(float));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+    // Farthest depth of every 2^level x 2^level pixel block
+    GLsizei levels = 1;
+    while ((std::max(width, height) >> levels) > 0)
+    {
+        levels++;
+    }
+    glGenTextures(1, &depthPyramid);
+    glBindTexture(GL_TEXTURE_2D, depthPyramid);
+    textureStorage(levels, GL_R32F, width, height, sizeof(float));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Bounding spheres of all clusters and whether they were visible in the last frame
+    std::vector<glm::vec4> spheres;
+    for (const auto &cluster : chunks.clusters)
+    {
+        spheres.push_back(glm::vec4(cluster.center, cluster.radius));
+    }
+    spheres.resize(std::max<size_t>(spheres.size(), 1));
+    glGenBuffers(1, &clusterBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, spheres.size() * sizeof(glm::vec4), spheres.data(), GL_STATIC_DRAW, MemoryCategory::GpuShaderBuffers);
+
+    std::vector<GLuint> visibility(spheres.size(), 0);
+    glGenBuffers(1, &clusterVisibilityBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterVisibilityBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, visibility.size() * sizeof(GLuint), visibility.data(), GL_DYNAMIC_COPY, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void initAdaptivePrimitives(size_t numSplats)
+{
+    // Indices of the transformed splats sorted by bin
+    glGenBuffers(1, &splatIndexBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, splatIndexBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(numSplats, 1) * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY, MemoryCategory::GpuShaderBuffers);
+
+    // Splats per bin, fill counters of the bins and the work groups of the second binning stage
+    glGenBuffers(1, &binBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, binBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, 3 * NUM_SPLAT_BINS * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void buildDepthPyramid(int width, int height)
+{
+    glBindTexture(GL_TEXTURE_2D, depthCopyTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+    glUseProgram(depthPyramidProgram);
+    auto levelLoc = glGetUniformLocation(depthPyramidProgram, "level");
+    glActiveTexture(GL_TEXTURE0);
+    GLint levels;
+    glBindTexture(GL_TEXTURE_2D, depthPyramid);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &levels);
+    glBindTexture(GL_TEXTURE_2D, depthCopyTexture);
+    for (GLint level = 0; level < levels; level++)
+    {
+        glUniform1i(levelLoc, level);
+        if (level > 0)
+        {
+            glBindImageTexture(0, depthPyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        }
+        glBindImageTexture(1, depthPyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        const GLuint levelWidth = std::max(width >> level, 1);
+        const GLuint levelHeight = std::max(height >> level, 1);
+        glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glCheckError();
+}
+
 void initEWASpecificBuffers(int width, int height)
 {
     // Texture for depth accumulation pass
     glGenTextures(1, &depthAccTexture);
     glBindTexture(GL_TEXTURE_2D, depthAccTexture);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    textureStorage(1, GL_RGBA32F, width, height, 4 * sizeof(float));
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
     // Texture for color accumulation pass
     glGenTextures(1, &colorAccTexture);
     glBindTexture(GL_TEXTURE_2D, colorAccTexture);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    textureStorage(1, GL_RGBA32F, width, height, 4 * sizeof(float));
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
     // Counter texture for normalization
     glGenTextures(1, &counterTexture);
     glBindTexture(GL_TEXTURE_2D, counterTexture);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    textureStorage(1, GL_RGBA32F, width, height, 4 * sizeof(float));
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
@@ -551,6 +1441,7 @@ void initEWASpecificBuffers(int width, int height)
     glGenRenderbuffers(1, &depthBuffer);
     glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    MemoryStats::instance().add(MemoryCategory::GpuTextures, size_t(width) * height * 4);
     glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
     glGenFramebuffers(1, &fbo);
@@ -561,6 +1452,11 @@ void initEWASpecificBuffers(int width, int height)
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    initFullscreenQuad();
+}
+
+void initFullscreenQuad()
+{
     // quad for screen-space computations in fragment shader
     glGenVertexArrays(1, &quadVao);
     glBindVertexArray(quadVao);
@@ -570,7 +1466,7 @@ void initEWASpecificBuffers(int width, int height)
                             -1.0f, 1.0f, 0.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 1.0f, -1.0f, 1.0f, 0.0f,
 
                             -1.0f, 1.0f, 0.0f, 1.0f, 1.0f,  -1.0f, 1.0f, 0.0f, 1.0f, 1.0f,  1.0f, 1.0f};
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
+    bufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW, MemoryCategory::GpuVertexBuffers);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(1);
@@ -579,154 +1475,106 @@ void initEWASpecificBuffers(int width, int height)
     glBindVertexArray(0);
 }
 
-void initShaders()
+void initComputeRasterizer(int width, int height)
 {
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    const char* vertexSource = SPLAT_VERT_STR;
-    glShaderSource(vertexShader, 1, &vertexSource, nullptr);
-    glCompileShader(vertexShader);
-    if (!checkShader(vertexShader, GL_VERTEX_SHADER))
+    // Closest depth and the splat it belongs to for every pixel
+    glGenBuffers(1, &frameDepthBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, frameDepthBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, width * height * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY, MemoryCategory::GpuShaderBuffers);
+    glGenBuffers(1, &frameSplatBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, frameSplatBuffer);
+    bufferData(GL_SHADER_STORAGE_BUFFER, width * height * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY, MemoryCategory::GpuShaderBuffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    initFullscreenQuad();
+}
+
+GLuint buildProgram(std::vector<PendingProgram> &programs, const std::string &name,
+                    std::initializer_list<std::pair<GLenum, const char *>> sources)
+{
+    PendingProgram pending{name, glCreateProgram(), {}};
+    for (const auto &source : sources)
     {
-        throw std::runtime_error("Shader compilation failed");
+        GLuint shader = glCreateShader(source.first);
+        glShaderSource(shader, 1, &source.second, nullptr);
+        glCompileShader(shader);
+        glAttachShader(pending.program, shader);
+        pending.shaders.push_back(shader);
     }
+    // the status is not queried yet, so the driver does not have to finish before the next program
+    glLinkProgram(pending.program);
+    programs.push_back(pending);
+    return pending.program;
+}
 
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    const char* fragmentSource = SPLAT_FRAG_STR;
-    glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
-    glCompileShader(fragmentShader);
-    if (!checkShader(fragmentShader, GL_FRAGMENT_SHADER))
+void enableParallelShaderCompile()
+{
+    typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+    if (!glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
     {
-        throw std::runtime_error("Shader compilation failed");
+        return;
     }
-
-    program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-
-    if (!checkProgram(program))
+    auto maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    if (maxShaderCompilerThreads)
     {
-        throw std::runtime_error("Shader linking failed");
+        // as many threads as the driver likes
+        maxShaderCompilerThreads(0xFFFFFFFF);
     }
-
-    glDetachShader(program, vertexShader);
-    glDetachShader(program, fragmentShader);
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
 }
 
-void initEWAShaders()
+std::vector<PendingProgram> compilePrograms(const std::string &method, bool occlusionCulling, bool adaptivePrimitives)
 {
-    // -------- VISIBILITY PASS ------------
+    std::vector<PendingProgram> programs;
+    transformProgram = buildProgram(programs, "Transform", {{GL_COMPUTE_SHADER, SPLATTRANSFORM_COMP_STR}});
+    if (method == "ewa" || method == "EWA")
     {
-        auto vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        auto vertexSourceStr = std::string(VISIBILITY_VERT_STR);
-        const char *vertexSource = vertexSourceStr.c_str();
-        glShaderSource(vertexShader, 1, &vertexSource, nullptr);
-        glCompileShader(vertexShader);
-        if (!checkShader(vertexShader, GL_VERTEX_SHADER))
-        {
-            throw std::runtime_error("Visibility vertex shader compilation failed");
-        }
-
-        auto fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        auto fragmentSourceStr = std::string(VISIBILITY_FRAG_STR);
-        const char *fragmentSource = fragmentSourceStr.c_str();
-        glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
-        glCompileShader(fragmentShader);
-        if (!checkShader(fragmentShader, GL_FRAGMENT_SHADER)) {
-            throw std::runtime_error("Visibility fragment shader compilation failed");
-        }
-
-        visibilityPassProgram = glCreateProgram();
-        glAttachShader(visibilityPassProgram, vertexShader);
-        glAttachShader(visibilityPassProgram, fragmentShader);
-        glLinkProgram(visibilityPassProgram);
-
-        if(!checkProgram(visibilityPassProgram))
-        {
-            throw std::runtime_error("Visibility shader linking failed");
-        }
-
-        glDetachShader(visibilityPassProgram, vertexShader);
-        glDetachShader(visibilityPassProgram, fragmentShader);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        visibilityPassProgram = buildProgram(programs, "Visibility", {{GL_VERTEX_SHADER, VISIBILITY_VERT_STR}, {GL_FRAGMENT_SHADER, VISIBILITY_FRAG_STR}});
+        splatcountProgram = buildProgram(programs, "Accumulation", {{GL_VERTEX_SHADER, EWASPLAT_VERT_STR}, {GL_FRAGMENT_SHADER, SPLATCOUNT_FRAG_STR}});
+        finalPassProgram = buildProgram(programs, "Interpolation", {{GL_VERTEX_SHADER, FULLSCREENQUAD_VERT_STR}, {GL_FRAGMENT_SHADER, FINAL_FRAG_STR}});
     }
-    // -----------------------------------------
-
-    // ----------ACCUMULATION COUNT PASS--------------
+    else if (method == "compute")
     {
-        auto vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        auto vertexSourceStr = std::string(EWASPLAT_VERT_STR);
-        const char *vertexSource = vertexSourceStr.c_str();
-        glShaderSource(vertexShader, 1, &vertexSource, nullptr);
-        glCompileShader(vertexShader);
-        if (!checkShader(vertexShader, GL_VERTEX_SHADER))
-        {
-            throw std::runtime_error("Accumulation vertex shader compilation failed");
-        }
-
-        auto fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        auto fragmentSourceStr = std::string(SPLATCOUNT_FRAG_STR);
-        const char *fragmentSource = fragmentSourceStr.c_str();
-        glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
-        glCompileShader(fragmentShader);
-        if (!checkShader(fragmentShader, GL_FRAGMENT_SHADER)) {
-            throw std::runtime_error("Accumulation fragment shader compilation failed");
-        }
-
-        splatcountProgram = glCreateProgram();
-        glAttachShader(splatcountProgram, vertexShader);
-        glAttachShader(splatcountProgram, fragmentShader);
-        glLinkProgram(splatcountProgram);
-
-        if(!checkProgram(splatcountProgram))
-        {
-            throw std::runtime_error("Accumulation shader linking failed");
-        }
-
-        glDetachShader(splatcountProgram, vertexShader);
-        glDetachShader(splatcountProgram, fragmentShader);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
+        rasterProgram = buildProgram(programs, "Rasterizer", {{GL_COMPUTE_SHADER, SPLATRASTER_COMP_STR}});
+        resolveProgram = buildProgram(programs, "Resolve", {{GL_VERTEX_SHADER, FULLSCREENQUAD_VERT_STR}, {GL_FRAGMENT_SHADER, SPLATRESOLVE_FRAG_STR}});
+    }
+    else
+    {
+        program = buildProgram(programs, "Splat", {{GL_VERTEX_SHADER, SPLAT_VERT_STR}, {GL_FRAGMENT_SHADER, SPLAT_FRAG_STR}});
+    }
+    if (occlusionCulling)
+    {
+        depthPyramidProgram = buildProgram(programs, "Depth pyramid", {{GL_COMPUTE_SHADER, HIZ_COMP_STR}});
     }
+    if (adaptivePrimitives)
+    {
+        binProgram = buildProgram(programs, "Binning", {{GL_COMPUTE_SHADER, SPLATBIN_COMP_STR}});
+    }
+    return programs;
+}
 
-    // ----------INTERPOLATION PASS -----------------
+void finishPrograms(const std::vector<PendingProgram> &programs)
+{
+    TRACE_ZONE("finish programs");
+    for (const auto &pending : programs)
     {
-        auto vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        auto vertexSourceStr = std::string(FULLSCREENQUAD_VERT_STR);
-        const char *vertexSource = vertexSourceStr.c_str();
-        glShaderSource(vertexShader, 1, &vertexSource, nullptr);
-        glCompileShader(vertexShader);
-        if (!checkShader(vertexShader, GL_VERTEX_SHADER))
+        for (auto shader : pending.shaders)
         {
-            throw std::runtime_error("Interpolation vertex shader compilation failed");
+            GLint type;
+            glGetShaderiv(shader, GL_SHADER_TYPE, &type);
+            if (!checkShader(shader, type))
+            {
+                throw std::runtime_error(pending.name + " shader compilation failed");
+            }
         }
-
-        auto fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        auto fragmentSourceStr = std::string(FINAL_FRAG_STR);
-        const char *fragmentSource = fragmentSourceStr.c_str();
-        glShaderSource(fragmentShader, 1, &fragmentSource, nullptr);
-        glCompileShader(fragmentShader);
-        if (!checkShader(fragmentShader, GL_FRAGMENT_SHADER)) {
-            throw std::runtime_error("Interpolation fragment shader compilation failed");
+        if (!checkProgram(pending.program))
+        {
+            throw std::runtime_error(pending.name + " shader linking failed");
         }
-
-        finalPassProgram = glCreateProgram();
-        glAttachShader(finalPassProgram, vertexShader);
-        glAttachShader(finalPassProgram, fragmentShader);
-        glLinkProgram(finalPassProgram);
-
-        if(!checkProgram(finalPassProgram))
+        for (auto shader : pending.shaders)
         {
-            throw std::runtime_error("Interpolation shader linking failed");
+            glDetachShader(pending.program, shader);
+            glDeleteShader(shader);
         }
-
-        glDetachShader(finalPassProgram, vertexShader);
-        glDetachShader(finalPassProgram, fragmentShader);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
     }
 }
 
@@ -736,7 +1584,7 @@ bool checkShader(GLuint shaderId, GLuint type)
     char infoLog[512];
     glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
 
-    std::string typeString = type == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT";
+    std::string typeString = type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_COMPUTE_SHADER ? "COMPUTE" : "FRAGMENT";
 
     if (!success)
     {
@@ -783,6 +1631,61 @@ std::vector<float> buildCircle(int fans, float radius)
     return vertices;
 }
 
+glm::mat4 projectionMatrix(int width, int height, float fx, float fy, float cx, float cy)
+{
+    glm::mat4 m(0.0f);
+    m[0][0] = 2.0f * fx / width;
+    m[0][1] = 0.0f;
+    m[0][2] = 0.0f;
+    m[0][3] = 0.0f;
+
+    m[1][0] = 0.0f;
+    m[1][1] = -2.0f * fy / height;
+    m[1][2] = 0.0f;
+    m[1][3] = 0.0f;
+
+    m[2][0] = 1.0f - 2.0f * cx / width;
+    m[2][1] = 2.0f * cy / height - 1.0f;
+    m[2][2] = (FAR + NEAR) / (NEAR - FAR);
+    m[2][3] = -1.0f;
+
+    m[3][0] = 0.0f;
+    m[3][1] = 0.0f;
+    m[3][2] = 2.0f * FAR * NEAR / (NEAR - FAR);
+    m[3][3] = 0.0f;
+
+    return m;
+}
+
+std::array<glm::vec4, 6> frustumPlanes(const glm::mat4 &clip)
+{
+    // Gribb/Hartmann plane extraction: left, right, bottom, top, near, far.
+    // A point p is inside if dot(plane.xyz, p) + plane.w >= 0 for all planes.
+    std::array<glm::vec4, 6> planes;
+    for (int i = 0; i < 3; i++)
+    {
+        planes[2 * i] = glm::row(clip, 3) + glm::row(clip, i);
+        planes[2 * i + 1] = glm::row(clip, 3) - glm::row(clip, i);
+    }
+    for (auto &plane : planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return planes;
+}
+
+std::vector<size_t> cullScene(const ChunkIndex &chunks, const glm::mat4 &projection, const glm::mat4 &view, float nearSlack,
+                              float focalLength, float lodThreshold, bool backfaceCulling, size_t &numVisibleChunks)
+{
+    const auto planes = frustumPlanes(projection * view);
+    const auto cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    auto visible = cullChunks(chunks, planes, nearSlack);
+    numVisibleChunks = visible.size();
+    // distant chunks are drawn with fewer but larger splats
+    const auto levels = selectLevels(chunks, visible, cameraPosition, focalLength, lodThreshold);
+    return cullClusters(chunks, visible, levels, planes, nearSlack, cameraPosition, backfaceCulling);
+}
+
 GLenum glCheckError_(const char *file, int line)
 {
     GLenum errorCode;
@@ -827,14 +1730,26 @@ void writeMat(const glm::mat4 &mat)
     std::cout << std::endl;
 }
 
-PointCloud readPly(const std::string &filepath, float defaultPointSize)
+PointCloud readPly(const std::string &filepath, float defaultPointSize, bool lowMemory)
 {
+    TRACE_ZONE("readPly");
     std::unique_ptr<std::istream> file_stream;
     std::vector<uint8_t> byte_buffer;
     try
     {
-        byte_buffer = read_file_binary(filepath);
-        file_stream.reset(new memory_stream((char *)byte_buffer.data(), byte_buffer.size()));
+        MemoryReservation fileMemory(MemoryCategory::PlyBuffers);
+        if (lowMemory)
+        {
+            // slower to parse, but the file is never held in memory as a whole
+            file_stream.reset(new std::ifstream(filepath, std::ios::binary));
+        }
+        else
+        {
+            MemoryStats::instance().checkBudget("Reading " + filepath, fs::file_size(filepath));
+            byte_buffer = read_file_binary(filepath);
+            fileMemory.resize(byte_buffer.size());
+            file_stream.reset(new memory_stream((char *)byte_buffer.data(), byte_buffer.size()));
+        }
 
         if (!file_stream || file_stream->fail())
             throw std::runtime_error("file_stream failed to open " + filepath);
@@ -882,13 +1797,21 @@ PointCloud readPly(const std::string &filepath, float defaultPointSize)
             no_color = true;
         }
 
-        try
+        // no renderer reads the confidence, it is only carried along
+        if (lowMemory)
         {
-            confidence = file.request_properties_from_element("vertex", {"confidence"});
+            no_confidence = true;
         }
-        catch (const std::exception &e)
+        else
         {
-            no_confidence = true;
+            try
+            {
+                confidence = file.request_properties_from_element("vertex", {"confidence"});
+            }
+            catch (const std::exception &e)
+            {
+                no_confidence = true;
+            }
         }
 
         try
@@ -900,11 +1823,47 @@ PointCloud readPly(const std::string &filepath, float defaultPointSize)
             no_radius = true;
         }
 
+        // the requested properties and the point cloud they are copied into, before any of them is allocated
+        size_t numVertices = 0;
+        size_t propertyBytes = 0;
+        for (const auto &e : file.get_elements())
+        {
+            if (e.name != "vertex")
+                continue;
+            numVertices = e.size;
+            for (const auto &p : e.properties)
+            {
+                for (const char *name : {"x", "y", "z", "nx", "ny", "nz", "red", "green", "blue", "confidence", "radius"})
+                {
+                    if (p.name == name && !(no_confidence && p.name == "confidence"))
+                        propertyBytes += e.size * tinyply::PropertyTable[p.propertyType].stride;
+                }
+            }
+        }
+        const size_t cloudBytes = numVertices * (POINT_CLOUD_BYTES_PER_POINT - (lowMemory ? sizeof(float) : 0));
+        // with low memory the properties are copied one after the other and dropped once they are copied
+        MemoryStats::instance().checkBudget("Reading " + filepath,
+                                            lowMemory ? std::max(propertyBytes + numVertices * sizeof(float3), cloudBytes)
+                                                      : propertyBytes + cloudBytes);
+
         manual_timer read_timer;
 
         read_timer.start();
         file.read(*file_stream);
         read_timer.stop();
+        file_stream.reset();
+        std::vector<uint8_t>().swap(byte_buffer);
+        fileMemory.resize(0);
+        for (const auto &data : {position, normal, color, confidence, radius})
+        {
+            if (data)
+                MemoryStats::instance().add(MemoryCategory::PlyBuffers, data->buffer.size_bytes());
+        }
+        // tinyply's copy of a property is dropped as soon as the point cloud has its own
+        auto release = [](const std::shared_ptr<PlyData> &data) {
+            MemoryStats::instance().remove(MemoryCategory::PlyBuffers, data->buffer.size_bytes());
+            data->buffer = tinyply::Buffer();
+        };
 
         const double parsing_time = read_timer.get() / 1000.f;
         std::cout << "\tparsing " << size_mb << "mb in " << parsing_time << " seconds [" << (size_mb / parsing_time) << " MBps]" << std::endl;
@@ -921,87 +1880,107 @@ PointCloud readPly(const std::string &filepath, float defaultPointSize)
             std::cout << "\tRead " << radius->count << " total point radii " << std::endl;
 
         PointCloud pcl;
-
-        pcl.position.resize(position->count);
-        pcl.normal.resize(position->count);
-        pcl.color.resize(position->count);
-        pcl.confidence.resize(position->count);
-        pcl.radius.resize(position->count);
-
-        auto t1 = std::async(std::launch::async, [&]() {
-            size_t numVerticesBytes = position->buffer.size_bytes();
+        const size_t count = position->count;
+        // the attributes are counted as soon as they exist, while the properties are still there
+        auto allocate = [](auto &values, size_t size) {
+            values.resize(size);
+            MemoryStats::instance().add(MemoryCategory::PointCloud, values.capacity() * sizeof(values[0]));
+        };
+
+        std::vector<std::function<void()>> copies;
+        copies.push_back([&]() {
+            allocate(pcl.position, count);
             if(position->t == tinyply::Type::FLOAT64){
-                std::vector<double3> tmp_buffer;
-                tmp_buffer.resize(position->count);
-                std::memcpy(tmp_buffer.data(), position->buffer.get(), numVerticesBytes);
-                std::transform(tmp_buffer.begin(), tmp_buffer.end(), pcl.position.begin(), [](double3 position){
-                    return float3{(float)position.x, (float)position.y, (float)position.z};
-                });
+                convertDoubles(reinterpret_cast<const double*>(position->buffer.get()), &pcl.position[0].x, 3 * count);
             }else{
-                std::memcpy(pcl.position.data(), position->buffer.get(), numVerticesBytes);
+                std::memcpy(pcl.position.data(), position->buffer.get(), position->buffer.size_bytes());
             }
-            std::transform(pcl.position.begin(), pcl.position.end(), pcl.position.begin(), [](float3 position) {
-                return float3{position.x, position.y, position.z};
-            });
+            release(position);
         });
 
-        auto t2 = std::async(std::launch::async, [&]() {
-            size_t numVerticesBytes = normal->buffer.size_bytes();
+        copies.push_back([&]() {
+            allocate(pcl.normal, count);
             if(normal->t == tinyply::Type::FLOAT64){
-                std::vector<double3> tmp_buffer;
-                tmp_buffer.resize(normal->count);
-                std::memcpy(tmp_buffer.data(), normal->buffer.get(), numVerticesBytes);
-                std::transform(tmp_buffer.begin(), tmp_buffer.end(), pcl.normal.begin(), [](double3 normal){
-                    return float3{(float)normal.x, (float)normal.y, (float)normal.z};
-                });
+                convertDoubles(reinterpret_cast<const double*>(normal->buffer.get()), &pcl.normal[0].x, 3 * normal->count);
             }else{
-                std::memcpy(pcl.normal.data(), normal->buffer.get(), numVerticesBytes);
+                std::memcpy(pcl.normal.data(), normal->buffer.get(), normal->buffer.size_bytes());
             }
-            std::transform(pcl.normal.begin(), pcl.normal.end(), pcl.normal.begin(), [](float3 normal) {
-                return float3{normal.x, normal.y, normal.z};
-            });
+            release(normal);
         });
 
-        auto t3 = std::async(std::launch::async, [&]() {
+        copies.push_back([&]() {
+            allocate(pcl.color, count);
             if(no_color){
-                pcl.color.assign(pcl.color.size(), {1, 1, 1});
+                std::fill(pcl.color.begin(), pcl.color.end(), uchar3{1, 1, 1});
             }else{
-                size_t numVerticesBytes = color->buffer.size_bytes();
-                std::memcpy(pcl.color.data(), color->buffer.get(), numVerticesBytes);
+                std::memcpy(pcl.color.data(), color->buffer.get(), color->buffer.size_bytes());
+                release(color);
             }
         });
 
-        auto t4 = std::async(std::launch::async, [&]() {
-            if(no_confidence){
-                pcl.confidence.assign(pcl.confidence.size(), 1.0f);
-            }else{
-                size_t numVerticesBytes = confidence->buffer.size_bytes();
-                std::memcpy(pcl.confidence.data(), confidence->buffer.get(), numVerticesBytes);
-            }
-        });
+        if (!lowMemory)
+        {
+            copies.push_back([&]() {
+                allocate(pcl.confidence, count);
+                if(no_confidence){
+                    std::fill(pcl.confidence.begin(), pcl.confidence.end(), 1.0f);
+                }else{
+                    std::memcpy(pcl.confidence.data(), confidence->buffer.get(), confidence->buffer.size_bytes());
+                    release(confidence);
+                }
+            });
+        }
 
-        auto t5 = std::async(std::launch::async, [&]() {
+        copies.push_back([&]() {
+            allocate(pcl.radius, count);
             if(no_radius){
-                pcl.radius.assign(pcl.radius.size(), defaultPointSize);
+                std::fill(pcl.radius.begin(), pcl.radius.end(), defaultPointSize);
             }else{
-                size_t numVerticesBytes = radius->buffer.size_bytes();
-                std::memcpy(pcl.radius.data(), radius->buffer.get(), numVerticesBytes);
+                std::memcpy(pcl.radius.data(), radius->buffer.get(), radius->buffer.size_bytes());
+                release(radius);
             }
         });
 
-        t1.get();
-        t2.get();
-        t3.get();
-        t4.get();
-        t5.get();
+        if (lowMemory)
+        {
+            // the properties and the point cloud never exist completely at the same time
+            for (auto &copy : copies)
+            {
+                copy();
+            }
+        }
+        else
+        {
+            auto &pool = ThreadPool::instance();
+            std::vector<std::future<void>> tasks;
+            for (auto &copy : copies)
+            {
+                tasks.push_back(pool.submit(copy));
+            }
+            for (auto &task : tasks)
+            {
+                pool.wait(task);
+            }
+        }
 
         pcl.size = pcl.position.size();
+        allocate(pcl.sourceIndex, pcl.size);
+        for (size_t i = 0; i < pcl.size; i++)
+        {
+            pcl.sourceIndex[i] = static_cast<uint32_t>(i);
+        }
+        // render counts it from here on
+        MemoryStats::instance().remove(MemoryCategory::PointCloud, memoryBytes(pcl));
         return pcl;
     }
+    catch (const MemoryBudgetExceeded &)
+    {
+        throw;
+    }
     catch (const std::exception &e)
     {
-        std::cerr << e.what() << '\n';
-        exit(1);
+        // runs on a loader thread, the caller of render gets the error
+        throw std::runtime_error("Could not read " + filepath + ": " + e.what());
     }
 }
 
@@ -1017,8 +1996,7 @@ std::vector<glm::mat4> loadTrajectoryFromFile(std::string path)
         ifs.open(path);
         if (!ifs)
         {
-            throw std::runtime_error("Unable to open trajectory file");
-            exit(1);
+            throw std::runtime_error("Unable to open trajectory file " + path);
         }
 
         // transform the trajectory into the right basis for our application
@@ -1050,8 +2028,7 @@ std::vector<glm::mat4> loadTrajectoryFromFile(std::string path)
         ifs.open(path);
         if (!ifs)
         {
-            throw std::runtime_error("Unable to open trajectory file");
-            exit(1);
+            throw std::runtime_error("Unable to open trajectory file " + path);
         }
 
         while(!ifs.eof()){
@@ -1076,6 +2053,161 @@ std::vector<glm::mat4> loadTrajectoryFromFile(std::string path)
     
 }
 
+void configureThreads(int numThreads, bool pinThreads)
+{
+    if (numThreads < 0)
+    {
+        throw std::runtime_error("The number of threads must not be negative");
+    }
+    ThreadPool::instance().configure(numThreads, pinThreads);
+}
+
+std::string selectSimdLevel(const std::string &level)
+{
+    return simdLevelName(setSimdLevel(parseSimdLevel(level)));
+}
+
+std::string currentSimdLevel()
+{
+    return simdLevelName(simdLevel());
+}
+
+py::dict passStatsDict(const PassStats &stats)
+{
+    py::dict result;
+    result["milliseconds"] = stats.milliseconds;
+    result["primitives"] = stats.primitives;
+    result["samples"] = stats.samples;
+    return result;
+}
+
+py::dict passStats()
+{
+    py::list frames;
+    std::array<PassStats, NUM_RENDER_PASSES> total;
+    for (const auto &frame : lastPassStats)
+    {
+        py::dict passes;
+        for (size_t p = 0; p < NUM_RENDER_PASSES; p++)
+        {
+            const auto &pass = frame.passes[p];
+            if (!pass.measured)
+                continue;
+            passes[renderPassName(static_cast<RenderPass>(p)).c_str()] = passStatsDict(pass);
+            total[p].measured = true;
+            total[p].milliseconds += pass.milliseconds;
+            total[p].primitives += pass.primitives;
+            total[p].samples += pass.samples;
+        }
+        py::dict entry;
+        entry["frame"] = frame.frame;
+        entry["passes"] = passes;
+        frames.append(entry);
+    }
+    py::dict totals;
+    for (size_t p = 0; p < NUM_RENDER_PASSES; p++)
+    {
+        if (total[p].measured)
+        {
+            totals[renderPassName(static_cast<RenderPass>(p)).c_str()] = passStatsDict(total[p]);
+        }
+    }
+    py::dict result;
+    result["frames"] = frames;
+    result["total"] = totals;
+    return result;
+}
+
+void printMemoryStats()
+{
+    const auto &memory = MemoryStats::instance();
+    const double megabyte = 1024 * 1024;
+    for (bool gpu : {false, true})
+    {
+        std::cout << (gpu ? "\tPeak GPU memory: " : "\tPeak host memory: ") << (gpu ? memory.peakGpu() : memory.peakHost()) / megabyte
+                  << " MB (";
+        bool first = true;
+        for (size_t c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+        {
+            const auto category = static_cast<MemoryCategory>(c);
+            if (isGpuMemory(category) == gpu)
+            {
+                std::cout << (first ? "" : ", ") << memoryCategoryName(category) << " " << memory.peak(category) / megabyte;
+                first = false;
+            }
+        }
+        std::cout << ")" << std::endl;
+    }
+}
+
+py::dict memoryReport()
+{
+    const auto &memory = MemoryStats::instance();
+    py::dict categories;
+    for (size_t c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+    {
+        const auto category = static_cast<MemoryCategory>(c);
+        py::dict bytes;
+        bytes["current"] = memory.current(category);
+        bytes["peak"] = memory.peak(category);
+        categories[memoryCategoryName(category).c_str()] = bytes;
+    }
+    py::dict host, gpu;
+    host["current"] = memory.currentHost();
+    host["peak"] = memory.peakHost();
+    gpu["current"] = memory.currentGpu();
+    gpu["peak"] = memory.peakGpu();
+    py::dict result;
+    result["host"] = host;
+    result["gpu"] = gpu;
+    result["categories"] = categories;
+    result["budget"] = memory.budget();
+    return result;
+}
+
+py::dict timingReport(const StageTimes &times)
+{
+    py::dict stages;
+    for (size_t s = 0; s < NUM_STAGES; s++)
+    {
+        stages[stageName(static_cast<Stage>(s)).c_str()] = times.seconds(static_cast<Stage>(s));
+    }
+    py::list frameSeconds;
+    for (auto seconds : times.frames())
+    {
+        frameSeconds.append(seconds);
+    }
+    py::dict result;
+    result["stages"] = stages;
+    result["frameSeconds"] = frameSeconds;
+    result["frames"] = times.frames().size();
+    result["seconds"] = times.framesSeconds();
+    result["framesPerSecond"] = times.framesPerSecond();
+    result["bytesWritten"] = times.bytesWritten();
+    result["bytesPerSecond"] = times.bytesPerSecond();
+    result["memory"] = memoryReport();
+    return result;
+}
+
+py::dict threadStats()
+{
+    const auto stats = ThreadPool::instance().stats();
+    py::list utilization;
+    for (auto busy : stats.busySeconds)
+    {
+        utilization.append(stats.seconds > 0.0 ? busy / stats.seconds : 0.0);
+    }
+    py::dict result;
+    result["threads"] = stats.numWorkers + 1;
+    result["tasksSubmitted"] = stats.tasksSubmitted;
+    result["tasksExecuted"] = stats.tasksExecuted;
+    result["tasksStolen"] = stats.tasksStolen;
+    result["maxQueueLength"] = stats.maxQueueLength;
+    result["seconds"] = stats.seconds;
+    result["utilization"] = utilization;
+    return result;
+}
+
 PYBIND11_MODULE(splat_renderer, m) {
     m.doc() = R"pbdoc(
         Splat rendering module
@@ -1083,10 +2215,42 @@ PYBIND11_MODULE(splat_renderer, m) {
 
     m.def("render", &render, R"pbdoc(
         Render a point cloud from a given camera trajectory and save the result in the output directory.
-        Returns 0 if no errors were encountered. Throws runtime exceptions
+        Returns the seconds spent in every stage, the render time of every frame, the frames per second and
+        the written bytes per second, which are also written to timingFile as JSON, and the current and peak
+        host and GPU memory by category. memoryBudget limits the host memory in MB, fewer frames are written at
+        once to stay within it and loading fails early if the point cloud does not fit. lowMemory parses the PLY
+        file without reading it into memory first, skips the unused confidence and frees the host copy of the
+        point cloud once it is uploaded to the GPU. Throws runtime exceptions
     )pbdoc", py::arg("pointcloud"), py::arg("trajectory"), py::arg("output"), py::arg("delta") = 1, py::arg("pointSize")=1e-2, 
              py::arg("width")=640, py::arg("height")=480, py::arg("fx")=520.0, py::arg("fy")=528.0, py::arg("cx")=320.0, py::arg("cy")=240.0,
-             py::arg("depthScale")=1000.0, py::arg("method")="standard", py::arg("surfaceThickness")=0.1);
+             py::arg("depthScale")=1000.0, py::arg("method")="standard", py::arg("surfaceThickness")=0.1, py::arg("backfaceCulling")=false,
+             py::arg("chunkSize")=1.0, py::arg("occlusionCulling")=false, py::arg("lodThreshold")=0.0, py::arg("lodCache")="",
+             py::arg("mortonOrder")=false, py::arg("adaptivePrimitives")=false, py::arg("profilePasses")=false,
+             py::arg("timingFile")="", py::arg("traceFile")="", py::arg("memoryBudget")=0.0,
+             py::arg("lowMemory")=false);
+
+    m.def("configureThreads", &configureThreads, R"pbdoc(
+        Set the number of threads of the thread pool, 0 uses all cores. Pinned threads stay on one core each.
+    )pbdoc", py::arg("numThreads")=0, py::arg("pinThreads")=false);
+
+    m.def("threadStats", &threadStats, R"pbdoc(
+        Statistics of the thread pool since the last call to render: tasks, steals, the longest queue and the
+        utilization of every worker.
+    )pbdoc");
+
+    m.def("passStats", &passStats, R"pbdoc(
+        GPU time, generated primitives and passed samples of every render pass in the last call to render with
+        profilePasses=True, per frame and summed over all frames.
+    )pbdoc");
+
+    m.def("setSimdLevel", &selectSimdLevel, R"pbdoc(
+        Select the instruction set of the CPU kernels: "scalar", "sse2", "avx2" or "avx512". Levels the CPU does
+        not support fall back to the highest supported one, returns the level in use.
+    )pbdoc", py::arg("level"));
+
+    m.def("simdLevel", &currentSimdLevel, R"pbdoc(
+        The instruction set the CPU kernels use.
+    )pbdoc");
 
     #ifdef VERSION_INFO
     m.attr("__version__") = VERSION_INFO;
@@ -0,0 +1,135 @@
+#include "memorystats.h"
+
+#include <limits>
+
+const size_t MEGABYTE = 1024 * 1024;
+
+std::string memoryCategoryName(MemoryCategory category)
+{
+    switch (category)
+    {
+    case MemoryCategory::PlyBuffers:
+        return "plyBuffers";
+    case MemoryCategory::PointCloud:
+        return "pointCloud";
+    case MemoryCategory::FrameBuffers:
+        return "frameBuffers";
+    case MemoryCategory::EncodeTemporaries:
+        return "encodeTemporaries";
+    case MemoryCategory::GpuVertexBuffers:
+        return "gpuVertexBuffers";
+    case MemoryCategory::GpuPixelBuffers:
+        return "gpuPixelBuffers";
+    case MemoryCategory::GpuTextures:
+        return "gpuTextures";
+    case MemoryCategory::GpuShaderBuffers:
+        return "gpuShaderBuffers";
+    default:
+        return "unknown";
+    }
+}
+
+bool isGpuMemory(MemoryCategory category)
+{
+    return category >= MemoryCategory::GpuVertexBuffers;
+}
+
+MemoryStats &MemoryStats::instance()
+{
+    // never destroyed, the pooled encoder arenas are freed at exit after it could be
+    static MemoryStats *stats = new MemoryStats();
+    return *stats;
+}
+
+MemoryStats::MemoryStats()
+{
+    for (size_t c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+    {
+        currentBytes[c] = 0;
+        peakBytes[c] = 0;
+    }
+}
+
+void MemoryStats::raise(std::atomic<uint64_t> &peak, uint64_t value)
+{
+    uint64_t previous = peak.load();
+    while (previous < value && !peak.compare_exchange_weak(previous, value))
+    {
+    }
+}
+
+void MemoryStats::add(MemoryCategory category, size_t bytes)
+{
+    const size_t c = static_cast<size_t>(category);
+    raise(peakBytes[c], currentBytes[c] += bytes);
+    if (isGpuMemory(category))
+        raise(gpuPeak, gpuCurrent += bytes);
+    else
+        raise(hostPeak, hostCurrent += bytes);
+}
+
+void MemoryStats::remove(MemoryCategory category, size_t bytes)
+{
+    currentBytes[static_cast<size_t>(category)] -= bytes;
+    if (isGpuMemory(category))
+        gpuCurrent -= bytes;
+    else
+        hostCurrent -= bytes;
+}
+
+void MemoryStats::releaseGpu()
+{
+    for (size_t c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+    {
+        if (isGpuMemory(static_cast<MemoryCategory>(c)))
+            currentBytes[c] = 0;
+    }
+    gpuCurrent = 0;
+}
+
+void MemoryStats::resetPeaks()
+{
+    for (size_t c = 0; c < NUM_MEMORY_CATEGORIES; c++)
+    {
+        peakBytes[c] = currentBytes[c].load();
+    }
+    hostPeak = hostCurrent.load();
+    gpuPeak = gpuCurrent.load();
+}
+
+size_t MemoryStats::current(MemoryCategory category) const
+{
+    return currentBytes[static_cast<size_t>(category)];
+}
+
+size_t MemoryStats::peak(MemoryCategory category) const
+{
+    return peakBytes[static_cast<size_t>(category)];
+}
+
+size_t MemoryStats::available() const
+{
+    const uint64_t budget = budgetBytes, used = hostCurrent;
+    if (budget == 0)
+        return std::numeric_limits<size_t>::max();
+    return used < budget ? budget - used : 0;
+}
+
+void MemoryStats::checkBudget(const std::string &what, size_t bytes) const
+{
+    if (bytes <= available())
+        return;
+    throw MemoryBudgetExceeded(what + " needs " + std::to_string(bytes / MEGABYTE) + " MB, but only " +
+                               std::to_string(available() / MEGABYTE) + " MB of the memory budget of " +
+                               std::to_string(budgetBytes / MEGABYTE) + " MB are left");
+}
+
+void MemoryReservation::resize(size_t newBytes)
+{
+    auto &stats = MemoryStats::instance();
+    if (newBytes > bytes)
+        stats.add(category, newBytes - bytes);
+    else if (newBytes < bytes)
+        stats.remove(category, bytes - newBytes);
+    bytes = newBytes;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// What the renderer allocates memory for, on the host and on the GPU
+enum class MemoryCategory
+{
+    PlyBuffers,  // the PLY file and the properties tinyply reads from it
+    PointCloud,
+    FrameBuffers,  // slabs of the frame pool
+    EncodeTemporaries,  // arenas lodepng encodes in
+    GpuVertexBuffers,  // splat attributes and primitive geometry
+    GpuPixelBuffers,  // pixel buffer objects of the readback
+    GpuTextures,  // accumulation textures of EWA splatting, depth copies and render buffers
+    GpuShaderBuffers,  // transformed splats and the buffers of culling, binning and compute rasterization
+    Count
+};
+
+const size_t NUM_MEMORY_CATEGORIES = static_cast<size_t>(MemoryCategory::Count);
+
+std::string memoryCategoryName(MemoryCategory category);
+bool isGpuMemory(MemoryCategory category);
+
+// Thrown before an allocation that would exceed the memory budget
+class MemoryBudgetExceeded : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Current and peak bytes of every category and of the host and GPU totals. Only the large allocations are
+// counted, not the whole process. Host allocations can be limited by a budget, which is checked before
+// them, so the renderer fails early or uses less memory instead of swapping. Can be updated from any thread.
+class MemoryStats
+{
+public:
+    // The statistics shared by the whole module
+    static MemoryStats &instance();
+
+    void add(MemoryCategory category, size_t bytes);
+    void remove(MemoryCategory category, size_t bytes);
+    // All GPU memory is gone with the context
+    void releaseGpu();
+    // Peaks start again at the current values
+    void resetPeaks();
+
+    size_t current(MemoryCategory category) const;
+    size_t peak(MemoryCategory category) const;
+    size_t currentHost() const { return hostCurrent; }
+    size_t peakHost() const { return hostPeak; }
+    size_t currentGpu() const { return gpuCurrent; }
+    size_t peakGpu() const { return gpuPeak; }
+
+    // Limit of the host memory, 0 for none
+    void setBudget(size_t bytes) { budgetBytes = bytes; }
+    size_t budget() const { return budgetBytes; }
+    // Host memory left within the budget, SIZE_MAX without one
+    size_t available() const;
+    // Throws MemoryBudgetExceeded if bytes more host memory do not fit into the budget
+    void checkBudget(const std::string &what, size_t bytes) const;
+
+private:
+    MemoryStats();
+    static void raise(std::atomic<uint64_t> &peak, uint64_t value);
+
+    std::array<std::atomic<uint64_t>, NUM_MEMORY_CATEGORIES> currentBytes;
+    std::array<std::atomic<uint64_t>, NUM_MEMORY_CATEGORIES> peakBytes;
+    std::atomic<uint64_t> hostCurrent{0}, hostPeak{0}, gpuCurrent{0}, gpuPeak{0};
+    std::atomic<uint64_t> budgetBytes{0};
+};
+
+// Counts bytes in a category while it exists
+class MemoryReservation
+{
+public:
+    explicit MemoryReservation(MemoryCategory category, size_t bytes = 0) : category(category), bytes(0) { resize(bytes); }
+    ~MemoryReservation() { resize(0); }
+    MemoryReservation(const MemoryReservation &) = delete;
+    MemoryReservation &operator=(const MemoryReservation &) = delete;
+
+    void resize(size_t newBytes);
+
+private:
+    MemoryCategory category;
+    size_t bytes;
+};
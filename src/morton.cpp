@@ -0,0 +1,123 @@
+#include "morton.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <glm/glm.hpp>
+
+// Bits per axis of the Morton code
+const uint32_t MORTON_BITS = 10;
+
+// The 30 bit codes are sorted in four passes of 8 bits each
+const uint32_t RADIX_BITS = 8;
+const uint32_t RADIX_SIZE = 1u << RADIX_BITS;
+const uint32_t RADIX_PASSES = 4;
+
+// Spreads the lower 10 bits of v such that there are two zero bits between them
+static uint32_t spreadBits(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+void sortMorton(PointCloud &pcl)
+{
+    if (pcl.size > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error("Point cloud has too many points for the Morton sort");
+    }
+    if (pcl.size < 2)
+        return;
+
+    glm::vec3 lower(std::numeric_limits<float>::max());
+    glm::vec3 upper(std::numeric_limits<float>::lowest());
+    for (const auto &p : pcl.position)
+    {
+        lower = glm::min(lower, glm::vec3(p.x, p.y, p.z));
+        upper = glm::max(upper, glm::vec3(p.x, p.y, p.z));
+    }
+    const float maxCell = float((1u << MORTON_BITS) - 1);
+    const glm::vec3 scale = maxCell / glm::max(upper - lower, glm::vec3(std::numeric_limits<float>::min()));
+
+    // every task owns a contiguous block of the input, which keeps the scatter stable
+    const size_t numTasks = ThreadPool::instance().concurrency();
+    const size_t perTask = (pcl.size + numTasks - 1) / numTasks;
+    auto parallel = [&](auto &&work) {
+        std::vector<std::future<void>> tasks;
+        for (size_t t = 0; t * perTask < pcl.size; t++)
+        {
+            tasks.push_back(ThreadPool::instance().submit([&, t]() { work(t, t * perTask, std::min(pcl.size, (t + 1) * perTask)); }));
+        }
+        for (auto &task : tasks)
+        {
+            ThreadPool::instance().wait(task);
+        }
+    };
+
+    std::vector<uint32_t> codes(pcl.size);
+    std::vector<uint32_t> order(pcl.size);
+    parallel([&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+        {
+            const auto &p = pcl.position[i];
+            const auto cell = glm::uvec3(glm::clamp((glm::vec3(p.x, p.y, p.z) - lower) * scale, 0.0f, maxCell));
+            codes[i] = mortonCode(cell.x, cell.y, cell.z);
+            order[i] = static_cast<uint32_t>(i);
+        }
+    });
+
+    // least significant digit radix sort of (code, index) pairs
+    std::vector<uint32_t> codesOut(pcl.size);
+    std::vector<uint32_t> orderOut(pcl.size);
+    std::vector<std::array<size_t, RADIX_SIZE>> offsets((pcl.size + perTask - 1) / perTask);
+    for (uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+    {
+        const uint32_t shift = pass * RADIX_BITS;
+        parallel([&](size_t t, size_t begin, size_t end) {
+            offsets[t].fill(0);
+            for (size_t i = begin; i < end; i++)
+            {
+                offsets[t][(codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+            }
+        });
+
+        // exclusive prefix sum over digits first and tasks second
+        size_t sum = 0;
+        for (uint32_t digit = 0; digit < RADIX_SIZE; digit++)
+        {
+            for (auto &taskOffsets : offsets)
+            {
+                const size_t count = taskOffsets[digit];
+                taskOffsets[digit] = sum;
+                sum += count;
+            }
+        }
+
+        parallel([&](size_t t, size_t begin, size_t end) {
+            auto &next = offsets[t];
+            for (size_t i = begin; i < end; i++)
+            {
+                const size_t slot = next[(codes[i] >> shift) & (RADIX_SIZE - 1)]++;
+                codesOut[slot] = codes[i];
+                orderOut[slot] = order[i];
+            }
+        });
+        codes.swap(codesOut);
+        order.swap(orderOut);
+    }
+
+    reorder(pcl, order);
+    std::cout << "\tSorted " << pcl.size << " points by Morton code" << std::endl;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "pointcloud.h"
+
+// Interleaves the lower 10 bits of x, y and z into a 30 bit Morton code
+uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z);
+
+// Sorts all attributes of the point cloud by the Morton code of the points on a 1024^3 grid
+// over their bounding box, so points close in space are also close in memory. pcl.sourceIndex
+// keeps track of where every point came from.
+void sortMorton(PointCloud &pcl);
@@ -0,0 +1,224 @@
+#include "parallel.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Index of the worker the current thread is, outside of the pool it is the number of workers
+static thread_local size_t currentWorker = std::numeric_limits<size_t>::max();
+
+static size_t defaultThreads()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+static void pinThread(std::thread::native_handle_type thread, size_t core)
+{
+#ifdef __linux__
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core % defaultThreads(), &cores);
+    if (pthread_setaffinity_np(thread, sizeof(cores), &cores) != 0)
+        std::cerr << "Could not pin thread to core " << core << std::endl;
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+
+ThreadPool &ThreadPool::instance()
+{
+    static ThreadPool pool(defaultThreads() - 1);
+    return pool;
+}
+
+ThreadPool::ThreadPool(size_t numWorkers, bool pinThreads)
+{
+    start(numWorkers, pinThreads);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+}
+
+void ThreadPool::configure(size_t numThreads, bool pinThreads)
+{
+    stop();
+#ifndef __linux__
+    if (pinThreads)
+        std::cerr << "Pinning threads is not supported on this platform" << std::endl;
+#endif
+    start((numThreads == 0 ? defaultThreads() : numThreads) - 1, pinThreads);
+}
+
+void ThreadPool::start(size_t numWorkers, bool pinThreads)
+{
+    stopping = false;
+    pending = 0;
+    for (size_t w = 0; w < numWorkers; w++)
+    {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (size_t w = 0; w < numWorkers; w++)
+    {
+        workers[w]->thread = std::thread(&ThreadPool::run, this, w);
+        if (pinThreads)
+            pinThread(workers[w]->thread.native_handle(), w + 1);
+    }
+#ifdef __linux__
+    if (pinThreads)
+        pinThread(pthread_self(), 0);
+#endif
+    resetStats();
+}
+
+void ThreadPool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto &worker : workers)
+    {
+        worker->thread.join();
+    }
+    workers.clear();
+}
+
+void ThreadPool::push(std::function<void()> task)
+{
+    submitted++;
+    if (workers.empty())
+    {
+        externalExecuted++;
+        task();
+        return;
+    }
+
+    // workers keep their own tasks, other threads spread them over all queues
+    const size_t queue = currentWorker < workers.size() ? currentWorker : nextQueue++ % workers.size();
+    auto &worker = *workers[queue];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        uint64_t length = worker.tasks.size();
+        uint64_t longest = maxQueueLength.load();
+        while (length > longest && !maxQueueLength.compare_exchange_weak(longest, length))
+        {
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pending++;
+    }
+    wakeUp.notify_one();
+}
+
+bool ThreadPool::pop(size_t self, std::function<void()> &task)
+{
+    bool found = false;
+    bool stolen = false;
+    if (self < workers.size())
+    {
+        auto &own = *workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (size_t k = 0; k < workers.size() && !found; k++)
+    {
+        const size_t victim = (self + 1 + k) % workers.size();
+        if (victim == self)
+            continue;
+        auto &other = *workers[victim];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            found = stolen = true;
+        }
+    }
+    if (!found)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pending--;
+    }
+    if (stolen && self < workers.size())
+        workers[self]->stolen++;
+    return true;
+}
+
+bool ThreadPool::runQueuedTask()
+{
+    const size_t self = currentWorker < workers.size() ? currentWorker : workers.size();
+    std::function<void()> task;
+    if (!pop(self, task))
+        return false;
+    // counted before running, the waiting thread may read the statistics as soon as the task finished
+    if (self < workers.size())
+        workers[self]->executed++;
+    else
+        externalExecuted++;
+    const auto start = std::chrono::steady_clock::now();
+    task();
+    if (self < workers.size())
+        workers[self]->busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+void ThreadPool::run(size_t self)
+{
+    currentWorker = self;
+    for (;;)
+    {
+        if (runQueuedTask())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this]() { return stopping || pending > 0; });
+        if (stopping && pending == 0)
+            return;
+    }
+}
+
+ThreadPoolStats ThreadPool::stats() const
+{
+    ThreadPoolStats stats;
+    stats.numWorkers = workers.size();
+    stats.tasksSubmitted = submitted;
+    stats.tasksExecuted = externalExecuted;
+    stats.maxQueueLength = maxQueueLength;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - statsStart).count();
+    for (const auto &worker : workers)
+    {
+        stats.tasksExecuted += worker->executed;
+        stats.tasksStolen += worker->stolen;
+        stats.busySeconds.push_back(worker->busyNanoseconds * 1e-9);
+    }
+    return stats;
+}
+
+void ThreadPool::resetStats()
+{
+    submitted = 0;
+    externalExecuted = 0;
+    maxQueueLength = 0;
+    for (auto &worker : workers)
+    {
+        worker->executed = 0;
+        worker->stolen = 0;
+        worker->busyNanoseconds = 0;
+    }
+    statsStart = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+struct ThreadPoolStats
+{
+    size_t numWorkers = 0;
+    uint64_t tasksSubmitted = 0;
+    uint64_t tasksExecuted = 0;  // including the tasks run by waiting threads outside the pool
+    uint64_t tasksStolen = 0;  // taken from the queue of another worker
+    uint64_t maxQueueLength = 0;
+    double seconds = 0.0;  // since the statistics were reset
+    std::vector<double> busySeconds;  // per worker
+};
+
+// Work-stealing pool all parallel work of the renderer runs on. Every worker owns a queue, it runs the
+// tasks it submitted itself last in first out and steals the oldest task of another queue when its own
+// is empty. Threads waiting for a task run queued tasks meanwhile, so tasks may wait for other tasks.
+class ThreadPool
+{
+public:
+    // The pool shared by the whole module, created with one worker less than there are cores
+    static ThreadPool &instance();
+
+    explicit ThreadPool(size_t numWorkers, bool pinThreads = false);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Replaces the workers, numThreads counts the calling thread too and 0 uses all cores. Pinned workers
+    // stay on one core each, the calling thread keeps the first core. Must not be called while tasks run.
+    void configure(size_t numThreads, bool pinThreads);
+
+    // Number of threads that work on parallel loops, the workers and the calling thread
+    size_t concurrency() const { return workers.size() + 1; }
+
+    template <typename Task>
+    std::future<typename std::result_of<Task()>::type> submit(Task &&task)
+    {
+        using Result = typename std::result_of<Task()>::type;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+        auto future = packaged->get_future();
+        push([packaged]() { (*packaged)(); });
+        return future;
+    }
+
+    // Runs queued tasks until the future is ready and returns its result
+    template <typename Result>
+    Result wait(std::future<Result> &future)
+    {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!runQueuedTask())
+                future.wait_for(std::chrono::microseconds(50));
+        }
+        return future.get();
+    }
+
+    ThreadPoolStats stats() const;
+    void resetStats();
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> busyNanoseconds{0};
+    };
+
+    void start(size_t numWorkers, bool pinThreads);
+    void stop();
+    void push(std::function<void()> task);
+    bool pop(size_t self, std::function<void()> &task);
+    bool runQueuedTask();
+    void run(size_t self);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    size_t pending = 0;  // queued tasks, guarded by sleepMutex
+    bool stopping = false;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<uint64_t> submitted{0};
+    std::atomic<uint64_t> externalExecuted{0};
+    std::atomic<uint64_t> maxQueueLength{0};
+    std::chrono::steady_clock::time_point statsStart;
+};
+
+// Calls work(task) for all tasks in [0, numTasks) on the thread pool, the calling thread takes part
+template <typename Work>
+void parallelFor(size_t numTasks, const Work &work)
+{
+    if (numTasks == 0)
+        return;
+    auto &pool = ThreadPool::instance();
+    std::vector<std::future<void>> tasks;
+    // the queued tasks refer to work, all of them have to finish before the first exception is passed on
+    std::exception_ptr error;
+    try
+    {
+        for (size_t t = 1; t < numTasks; t++)
+        {
+            tasks.push_back(pool.submit([&work, t]() { work(t); }));
+        }
+        work(0);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    for (auto &task : tasks)
+    {
+        try
+        {
+            pool.wait(task);
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Calls work(item) for all items in [0, numItems) on all cores. Every worker starts on its own contiguous
+// block of items and steals single items from the end of the other blocks once its own block is finished.
+template <typename Work>
+void parallelForStealing(size_t numItems, const Work &work)
+{
+    struct Block
+    {
+        std::mutex mutex;
+        size_t begin;
+        size_t end;
+    };
+    const size_t numWorkers = std::min<size_t>(numItems, ThreadPool::instance().concurrency());
+    if (numWorkers == 0)
+        return;
+    std::vector<Block> blocks(numWorkers);
+    for (size_t w = 0; w < numWorkers; w++)
+    {
+        blocks[w].begin = numItems * w / numWorkers;
+        blocks[w].end = numItems * (w + 1) / numWorkers;
+    }
+
+    parallelFor(numWorkers, [&](size_t w) {
+        for (;;)
+        {
+            size_t item = std::numeric_limits<size_t>::max();
+            {
+                std::lock_guard<std::mutex> lock(blocks[w].mutex);
+                if (blocks[w].begin < blocks[w].end)
+                    item = blocks[w].begin++;
+            }
+            for (size_t k = 1; k < numWorkers && item == std::numeric_limits<size_t>::max(); k++)
+            {
+                auto &victim = blocks[(w + k) % numWorkers];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.begin < victim.end)
+                    item = --victim.end;
+            }
+            if (item == std::numeric_limits<size_t>::max())
+                return;
+            work(item);
+        }
+    });
+}
@@ -0,0 +1,160 @@
+#include "passprofiler.h"
+
+#include <fstream>
+#include <stdexcept>
+
+static const std::array<GLenum, 3> QUERY_TARGETS = {GL_TIME_ELAPSED, GL_PRIMITIVES_GENERATED, GL_SAMPLES_PASSED};
+
+std::string renderPassName(RenderPass pass)
+{
+    switch (pass)
+    {
+    case RenderPass::Transform:
+        return "transform";
+    case RenderPass::Occlusion:
+        return "occlusion";
+    case RenderPass::Visibility:
+        return "visibility";
+    case RenderPass::Accumulation:
+        return "accumulation";
+    case RenderPass::Interpolation:
+        return "interpolation";
+    case RenderPass::Draw:
+        return "draw";
+    case RenderPass::Rasterization:
+        return "rasterization";
+    case RenderPass::Readback:
+        return "readback";
+    default:
+        return "unknown";
+    }
+}
+
+PassProfiler::PassProfiler(bool enabled) : enabled(enabled)
+{
+}
+
+void PassProfiler::beginFrame(int frame)
+{
+    if (!enabled)
+        return;
+    end();
+    current = numFrames++ % NUM_SLOTS;
+    collect(slots[current]);
+    slots[current].frame = frame;
+}
+
+void PassProfiler::begin(RenderPass pass)
+{
+    if (!enabled)
+        return;
+    end();
+    auto &slot = slots[current];
+    if (slot.numUsed == slot.measurements.size())
+    {
+        slot.measurements.emplace_back();
+        glGenQueries(static_cast<GLsizei>(NUM_QUERY_TYPES), slot.measurements.back().queries.data());
+    }
+    auto &measurement = slot.measurements[slot.numUsed++];
+    measurement.pass = pass;
+    for (size_t q = 0; q < NUM_QUERY_TYPES; q++)
+    {
+        glBeginQuery(QUERY_TARGETS[q], measurement.queries[q]);
+    }
+    running = true;
+}
+
+void PassProfiler::end()
+{
+    if (!running)
+        return;
+    for (auto target : QUERY_TARGETS)
+    {
+        glEndQuery(target);
+    }
+    running = false;
+}
+
+void PassProfiler::finish()
+{
+    if (!enabled)
+        return;
+    end();
+    // the older frame first
+    for (size_t s = 1; s <= NUM_SLOTS; s++)
+    {
+        collect(slots[(current + s) % NUM_SLOTS]);
+    }
+    for (auto &slot : slots)
+    {
+        for (auto &measurement : slot.measurements)
+        {
+            glDeleteQueries(static_cast<GLsizei>(measurement.queries.size()), measurement.queries.data());
+        }
+        slot.measurements.clear();
+    }
+}
+
+void PassProfiler::collect(Slot &slot)
+{
+    if (slot.frame < 0)
+        return;
+    FramePassStats stats;
+    stats.frame = slot.frame;
+    for (size_t m = 0; m < slot.numUsed; m++)
+    {
+        const auto &measurement = slot.measurements[m];
+        std::array<GLuint64, NUM_QUERY_TYPES> values;
+        for (size_t q = 0; q < NUM_QUERY_TYPES; q++)
+        {
+            glGetQueryObjectui64v(measurement.queries[q], GL_QUERY_RESULT, &values[q]);
+        }
+        auto &pass = stats.passes[static_cast<size_t>(measurement.pass)];
+        pass.measured = true;
+        pass.milliseconds += values[0] * 1e-6;
+        pass.primitives += values[1];
+        pass.samples += values[2];
+    }
+    results.push_back(stats);
+    slot.frame = -1;
+    slot.numUsed = 0;
+}
+
+std::array<PassStats, NUM_RENDER_PASSES> PassProfiler::total() const
+{
+    std::array<PassStats, NUM_RENDER_PASSES> sums;
+    for (const auto &frame : results)
+    {
+        for (size_t p = 0; p < NUM_RENDER_PASSES; p++)
+        {
+            if (!frame.passes[p].measured)
+                continue;
+            sums[p].measured = true;
+            sums[p].milliseconds += frame.passes[p].milliseconds;
+            sums[p].primitives += frame.passes[p].primitives;
+            sums[p].samples += frame.passes[p].samples;
+        }
+    }
+    return sums;
+}
+
+void PassProfiler::writeCsv(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not write " + path);
+    }
+    file << "frame,pass,milliseconds,primitives,samples\n";
+    for (const auto &frame : results)
+    {
+        for (size_t p = 0; p < NUM_RENDER_PASSES; p++)
+        {
+            const auto &pass = frame.passes[p];
+            if (!pass.measured)
+                continue;
+            file << frame.frame << "," << renderPassName(static_cast<RenderPass>(p)) << "," << pass.milliseconds << ","
+                 << pass.primitives << "," << pass.samples << "\n";
+        }
+    }
+}
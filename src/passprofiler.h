@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+// Passes of the GL methods that are measured separately
+enum class RenderPass
+{
+    Transform,
+    Occlusion,
+    Visibility,
+    Accumulation,
+    Interpolation,
+    Draw,
+    Rasterization,
+    Readback,
+    Count
+};
+
+const size_t NUM_RENDER_PASSES = static_cast<size_t>(RenderPass::Count);
+
+std::string renderPassName(RenderPass pass);
+
+struct PassStats
+{
+    bool measured = false;  // the pass ran in this frame
+    double milliseconds = 0.0;  // GPU time
+    uint64_t primitives = 0;  // primitives generated
+    uint64_t samples = 0;  // samples that passed the depth test
+};
+
+struct FramePassStats
+{
+    int frame = 0;  // index in the trajectory
+    std::array<PassStats, NUM_RENDER_PASSES> passes;
+};
+
+// Measures the GPU time, the generated primitives and the passed samples of every pass with queries.
+// The queries of a frame are read back two frames later, when the GPU has long finished them, so the
+// measurements do not stall the pipeline. Does nothing if it is disabled.
+class PassProfiler
+{
+public:
+    explicit PassProfiler(bool enabled);
+    PassProfiler(const PassProfiler &) = delete;
+    PassProfiler &operator=(const PassProfiler &) = delete;
+
+    void beginFrame(int frame);
+    // Ends the running pass and starts the next one, a pass may run several times per frame
+    void begin(RenderPass pass);
+    void end();
+    // Reads the results of the remaining frames and deletes the queries, the context has to be current
+    void finish();
+
+    const std::vector<FramePassStats> &frames() const { return results; }
+    // Sums of all frames
+    std::array<PassStats, NUM_RENDER_PASSES> total() const;
+    // One line per frame and pass: frame,pass,milliseconds,primitives,samples
+    void writeCsv(const std::string &path) const;
+
+private:
+    static const size_t NUM_SLOTS = 2;
+    static const size_t NUM_QUERY_TYPES = 3;
+
+    struct Measurement
+    {
+        RenderPass pass;
+        std::array<GLuint, NUM_QUERY_TYPES> queries;
+    };
+
+    struct Slot
+    {
+        int frame = -1;  // -1 if it holds no frame
+        std::vector<Measurement> measurements;  // the queries are kept for later frames
+        size_t numUsed = 0;
+    };
+
+    void collect(Slot &slot);
+
+    bool enabled;
+    std::array<Slot, NUM_SLOTS> slots;
+    size_t current = 0;
+    bool running = false;
+    size_t numFrames = 0;
+    std::vector<FramePassStats> results;
+};
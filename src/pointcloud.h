@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "parallel.h"
+#include "utils.h"
+
+// Source index of splats that were not read from the file, e.g. merged levels of detail
+const uint32_t NO_SOURCE_INDEX = 0xffffffffu;
+
+struct PointCloud
+{
+    std::vector<float3> position;
+    std::vector<uchar3> color;
+    std::vector<float3> normal;
+    std::vector<float> confidence;  // empty if it was not read, no renderer uses it
+    std::vector<float> radius;
+    std::vector<uint32_t> sourceIndex;  // index of every point in the file it was read from
+    size_t size;
+};
+
+// Attributes of one point read from a file
+const size_t POINT_CLOUD_BYTES_PER_POINT = 2 * sizeof(float3) + sizeof(uchar3) + 2 * sizeof(float) + sizeof(uint32_t);
+
+inline size_t memoryBytes(const PointCloud &pcl)
+{
+    return pcl.position.capacity() * sizeof(float3) + pcl.color.capacity() * sizeof(uchar3) +
+           pcl.normal.capacity() * sizeof(float3) + pcl.confidence.capacity() * sizeof(float) +
+           pcl.radius.capacity() * sizeof(float) + pcl.sourceIndex.capacity() * sizeof(uint32_t);
+}
+
+// Replaces the values by values[order[i]], attributes that were not read stay empty
+template <typename T>
+void permute(std::vector<T> &values, const std::vector<uint32_t> &order)
+{
+    if (values.empty())
+        return;
+    std::vector<T> permuted(order.size());
+    const size_t numTasks = ThreadPool::instance().concurrency();
+    parallelFor(numTasks, [&](size_t t) {
+        const size_t end = order.size() * (t + 1) / numTasks;
+        for (size_t i = order.size() * t / numTasks; i < end; i++)
+        {
+            permuted[i] = values[order[i]];
+        }
+    });
+    values.swap(permuted);
+}
+
+// Moves the point order[i] to position i. One attribute after the other is permuted by all threads, so
+// only a single attribute exists twice at any time.
+inline void reorder(PointCloud &pcl, const std::vector<uint32_t> &order)
+{
+    permute(pcl.position, order);
+    permute(pcl.normal, order);
+    permute(pcl.color, order);
+    permute(pcl.confidence, order);
+    permute(pcl.radius, order);
+    permute(pcl.sourceIndex, order);
+}
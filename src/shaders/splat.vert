@@ -1,40 +1,40 @@
 #version 450 core
 layout(location=0) in vec3 aPos;
-layout(location=1) in vec3 offset;
-layout(location=2) in float radius;
-layout(location=3) in vec3 color;
-layout(location=4) in vec3 normal;
+
+struct Splat {
+    vec3 center;
+    float radius;
+    vec3 u;
+    uint color;
+    vec3 v;
+    uint index;
+};
+
+struct DrawArraysIndirectCommand {
+    uint count;
+    uint instanceCount;
+    uint first;
+    uint baseInstance;
+};
+
+layout(std430, binding=4) readonly buffer Splats { Splat splats[]; };
+layout(std430, binding=5) readonly buffer DrawCommands { DrawArraysIndirectCommand drawCommands[]; };
+layout(std430, binding=9) readonly buffer SplatIndices { uint splatIndices[]; }; // splats sorted by primitive
 
 uniform mat4 projection;
-uniform mat4 view;
+uniform uint drawIndex; // draw command the splats were appended to
+uniform bool binned; // drawn with adaptive primitives
 
 out vec3 vColor;
 out vec4 vPos;
 
-mat4 rotationMatrix(vec3 axis, float angle)
-{
-    axis = normalize(axis);
-    float s = sin(angle);
-    float c = cos(angle);
-    float oc = 1.0 - c;
-    
-    return mat4(oc * axis.x * axis.x + c,           oc * axis.x * axis.y - axis.z * s,  oc * axis.z * axis.x + axis.y * s,  0.0,
-                oc * axis.x * axis.y + axis.z * s,  oc * axis.y * axis.y + c,           oc * axis.y * axis.z - axis.x * s,  0.0,
-                oc * axis.z * axis.x - axis.y * s,  oc * axis.y * axis.z + axis.x * s,  oc * axis.z * axis.z + c,           0.0,
-                0.0,                                0.0,                                0.0,                                1.0);
-}
-
 void main()
 {
-    vec3 currOrientation = vec3(0.0, 0.0, -1.0); // straight to the front
-    vec3 axis = cross(normal, currOrientation);
-    float theta = acos(dot(currOrientation, normalize(normal)));
-
-    // rotate each point such that the currOrientation and the target orientation (normal) align
-    mat3 rot = mat3(rotationMatrix(axis, theta));
-
-    vPos = view * vec4(rot*(radius*aPos) + offset, 1.0);
+    // splat was already transformed to view space in the transform pass
+    uint slot = drawCommands[drawIndex].baseInstance + gl_InstanceID;
+    Splat splat = splats[binned ? splatIndices[slot] : slot];
+    vPos = vec4(splat.center + aPos.x*splat.u + aPos.y*splat.v, 1.0);
 
     gl_Position = projection * vPos;
-    vColor = color;
-}
\ No newline at end of file
+    vColor = unpackUnorm4x8(splat.color).rgb;
+}
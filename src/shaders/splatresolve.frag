@@ -0,0 +1,42 @@
+#version 450 core
+
+// Writes the result of the software rasterizer (see splatraster.comp) to the framebuffer
+
+struct Splat {
+  vec3 center; // view space
+  float radius;
+  vec3 u; // disc axes in view space, already scaled by the radius
+  uint color;
+  vec3 v;
+  uint index;
+};
+
+layout(std430, binding = 4) readonly buffer Splats { Splat splats[]; };
+layout(std430, binding = 11) readonly buffer FrameDepth { uint frameDepth[]; };
+layout(std430, binding = 12) readonly buffer FrameSplat { uint frameSplat[]; };
+
+uniform mat4 inverseProjection;
+uniform ivec2 viewport;
+uniform uint firstSlot; // only the pixels of the splats of the bound window are written
+uniform uint numSlots;
+
+out vec4 FragColor;
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  uint index = uint(pixel.y * viewport.x + pixel.x);
+  uint splat = frameSplat[index] - firstSlot;
+  if (frameSplat[index] == 0xffffffffu || splat >= numSlots)
+    discard;
+
+  // view space position on the disc, same as the rasterizer
+  vec2 ndc = 2.0 * (vec2(pixel) + 0.5) / vec2(viewport) - 1.0;
+  vec4 onNear = inverseProjection * vec4(ndc, -1.0, 1.0);
+  vec3 direction = onNear.xyz / onNear.w;
+  vec3 normal = cross(splats[splat].u, splats[splat].v);
+  vec3 position = dot(splats[splat].center, normal) / dot(direction, normal) * direction;
+
+  // same output as splat.frag
+  FragColor = vec4(vec3(-position.z / 5.0f), 1.0f);
+  gl_FragDepth = uintBitsToFloat(frameDepth[index]);
+}
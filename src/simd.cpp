@@ -0,0 +1,813 @@
+#include "simd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Every kernel is compiled for its instruction set regardless of the flags of the whole build
+#if defined(__GNUC__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+// The vector kernels have to round exactly like the scalar ones, AVX-512 implies FMA and GCC would fuse
+// the multiplications and additions of the depth linearization otherwise
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// Largest number of bytes the sums of adler32 can take before they overflow
+const size_t ADLER_BLOCK = 5552;
+const unsigned ADLER_BASE = 65521;
+
+static SimdLevel detectSimdLevel()
+{
+#if defined(SIMD_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse2 = (info[3] & (1 << 26)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    // the operating system has to save the vector registers
+    const unsigned long long enabled = (info[2] & (1 << 27)) ? _xgetbv(0) : 0;
+    if (maxLeaf >= 7 && avx && (enabled & 0x6) == 0x6)
+    {
+        __cpuidex(info, 7, 0);
+        if ((info[1] & (1 << 16)) && (info[1] & (1 << 30)) && (enabled & 0xe6) == 0xe6)
+            return SimdLevel::AVX512;
+        if (info[1] & (1 << 5))
+            return SimdLevel::AVX2;
+    }
+    if (sse2)
+        return SimdLevel::SSE2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+static SimdLevel supportedLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+static SimdLevel initialLevel()
+{
+    const char *forced = std::getenv("SPLAT_RENDERER_SIMD");
+    if (!forced)
+        return supportedLevel();
+    try
+    {
+        const auto level = parseSimdLevel(forced);
+        if (level > supportedLevel())
+        {
+            std::cerr << "SPLAT_RENDERER_SIMD=" << forced << " is not supported by this CPU, using "
+                      << simdLevelName(supportedLevel()) << std::endl;
+            return supportedLevel();
+        }
+        return level;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return supportedLevel();
+    }
+}
+
+static std::atomic<SimdLevel> &activeLevel()
+{
+    static std::atomic<SimdLevel> level(initialLevel());
+    return level;
+}
+
+SimdLevel simdLevel()
+{
+    return activeLevel();
+}
+
+std::string simdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::SSE2:
+        return "sse2";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+SimdLevel parseSimdLevel(const std::string &name)
+{
+    for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::AVX512})
+    {
+        if (simdLevelName(level) == name)
+            return level;
+    }
+    throw std::runtime_error("Unknown SIMD level " + name + ", expected scalar, sse2, avx2 or avx512");
+}
+
+SimdLevel setSimdLevel(SimdLevel level)
+{
+    activeLevel() = std::min(level, supportedLevel());
+    return activeLevel();
+}
+
+// CONVERSION
+
+static void convertDoublesScalar(const double *in, float *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = static_cast<float>(in[i]);
+    }
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static void convertDoublesSSE2(const double *in, float *out, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+        const __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+        _mm_storeu_ps(out + i, _mm_movelh_ps(low, high));
+    }
+    convertDoublesScalar(in + i, out + i, count - i);
+}
+
+SIMD_TARGET("avx2") static void convertDoublesAVX2(const double *in, float *out, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i)));
+    }
+    convertDoublesScalar(in + i, out + i, count - i);
+}
+
+SIMD_TARGET("avx512f,avx512bw") static void convertDoublesAVX512(const double *in, float *out, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(out + i, _mm512_cvtpd_ps(_mm512_loadu_pd(in + i)));
+    }
+    convertDoublesScalar(in + i, out + i, count - i);
+}
+#endif
+
+void convertDoubles(const double *in, float *out, size_t count)
+{
+    switch (simdLevel())
+    {
+#ifdef SIMD_X86
+    case SimdLevel::AVX512:
+        return convertDoublesAVX512(in, out, count);
+    case SimdLevel::AVX2:
+        return convertDoublesAVX2(in, out, count);
+    case SimdLevel::SSE2:
+        return convertDoublesSSE2(in, out, count);
+#endif
+    default:
+        return convertDoublesScalar(in, out, count);
+    }
+}
+
+// DEPTH
+
+struct DepthConstants
+{
+    float numerator;  // 2 * near * far
+    float sum;  // far + near
+    float difference;  // far - near
+    float scale;
+};
+
+static void packDepthScalar(const float *depth, unsigned char *out, size_t count, const DepthConstants &constants)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        float d = depth[i];
+        if (d > 0.0f && d < 1.0f)
+        {
+            d = (2.0f * d) - 1.0f;
+            d = constants.numerator / (constants.sum - (d * constants.difference));
+        }
+        else
+        {
+            d = 0.0f;
+        }
+        // we do not have sub millimeter accuracy, the vector kernels truncate to 32 bit integers as well
+        const auto value = static_cast<uint16_t>(static_cast<int32_t>(d * constants.scale));
+        out[2 * i] = static_cast<unsigned char>(value >> 8);
+        out[2 * i + 1] = static_cast<unsigned char>(value & 0xff);
+    }
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static inline __m128i linearDepthSSE2(__m128 d, const DepthConstants &constants)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 inside = _mm_and_ps(_mm_cmpgt_ps(d, _mm_setzero_ps()), _mm_cmplt_ps(d, one));
+    const __m128 ndc = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.0f), d), one);
+    const __m128 linear = _mm_div_ps(_mm_set1_ps(constants.numerator),
+                                     _mm_sub_ps(_mm_set1_ps(constants.sum), _mm_mul_ps(ndc, _mm_set1_ps(constants.difference))));
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_and_ps(inside, linear), _mm_set1_ps(constants.scale)));
+}
+
+SIMD_TARGET("sse2") static void packDepthSSE2(const float *depth, unsigned char *out, size_t count, const DepthConstants &constants)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        // sign extending the low 16 bits keeps them unchanged by the saturation of the pack
+        const __m128i low = _mm_srai_epi32(_mm_slli_epi32(linearDepthSSE2(_mm_loadu_ps(depth + i), constants), 16), 16);
+        const __m128i high = _mm_srai_epi32(_mm_slli_epi32(linearDepthSSE2(_mm_loadu_ps(depth + i + 4), constants), 16), 16);
+        const __m128i values = _mm_packs_epi32(low, high);
+        const __m128i bigEndian = _mm_or_si128(_mm_slli_epi16(values, 8), _mm_srli_epi16(values, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i), bigEndian);
+    }
+    packDepthScalar(depth + i, out + 2 * i, count - i, constants);
+}
+
+SIMD_TARGET("avx2") static inline __m256i linearDepthAVX2(__m256 d, const DepthConstants &constants)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 inside = _mm256_and_ps(_mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(d, one, _CMP_LT_OQ));
+    const __m256 ndc = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), d), one);
+    const __m256 linear = _mm256_div_ps(_mm256_set1_ps(constants.numerator),
+                                        _mm256_sub_ps(_mm256_set1_ps(constants.sum), _mm256_mul_ps(ndc, _mm256_set1_ps(constants.difference))));
+    return _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_and_ps(inside, linear), _mm256_set1_ps(constants.scale)));
+}
+
+SIMD_TARGET("avx2") static void packDepthAVX2(const float *depth, unsigned char *out, size_t count, const DepthConstants &constants)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m256i low = _mm256_srai_epi32(_mm256_slli_epi32(linearDepthAVX2(_mm256_loadu_ps(depth + i), constants), 16), 16);
+        const __m256i high = _mm256_srai_epi32(_mm256_slli_epi32(linearDepthAVX2(_mm256_loadu_ps(depth + i + 8), constants), 16), 16);
+        // the pack interleaves the 128 bit lanes of both inputs
+        const __m256i values = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+        const __m256i bigEndian = _mm256_or_si256(_mm256_slli_epi16(values, 8), _mm256_srli_epi16(values, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i), bigEndian);
+    }
+    packDepthScalar(depth + i, out + 2 * i, count - i, constants);
+}
+
+SIMD_TARGET("avx512f,avx512bw") static void packDepthAVX512(const float *depth, unsigned char *out, size_t count, const DepthConstants &constants)
+{
+    const __m512 one = _mm512_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m512 d = _mm512_loadu_ps(depth + i);
+        const __mmask16 inside = _mm512_cmp_ps_mask(d, _mm512_setzero_ps(), _CMP_GT_OQ) & _mm512_cmp_ps_mask(d, one, _CMP_LT_OQ);
+        const __m512 ndc = _mm512_sub_ps(_mm512_mul_ps(_mm512_set1_ps(2.0f), d), one);
+        const __m512 linear = _mm512_div_ps(_mm512_set1_ps(constants.numerator),
+                                            _mm512_sub_ps(_mm512_set1_ps(constants.sum), _mm512_mul_ps(ndc, _mm512_set1_ps(constants.difference))));
+        const __m512 scaled = _mm512_mul_ps(_mm512_maskz_mov_ps(inside, linear), _mm512_set1_ps(constants.scale));
+        // truncates to the low 16 bits like the scalar conversion
+        const __m256i values = _mm512_cvtepi32_epi16(_mm512_cvttps_epi32(scaled));
+        const __m256i bigEndian = _mm256_or_si256(_mm256_slli_epi16(values, 8), _mm256_srli_epi16(values, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 2 * i), bigEndian);
+    }
+    packDepthScalar(depth + i, out + 2 * i, count - i, constants);
+}
+#endif
+
+void packDepth(const float *depth, unsigned char *out, int width, int height, float near, float far, float depthScale)
+{
+    const DepthConstants constants{2.0f * near * far, far + near, far - near, depthScale};
+    auto kernel = packDepthScalar;
+    switch (simdLevel())
+    {
+#ifdef SIMD_X86
+    case SimdLevel::AVX512:
+        kernel = packDepthAVX512;
+        break;
+    case SimdLevel::AVX2:
+        kernel = packDepthAVX2;
+        break;
+    case SimdLevel::SSE2:
+        kernel = packDepthSSE2;
+        break;
+#endif
+    default:
+        break;
+    }
+    // the image is flipped on the way
+    for (int row = 0; row < height; row++)
+    {
+        kernel(&depth[static_cast<size_t>(height - row - 1) * width], &out[static_cast<size_t>(row) * width * 2], width, constants);
+    }
+}
+
+void flipRows(const unsigned char *image, unsigned char *out, size_t rowSize, int height)
+{
+    for (int row = 0; row < height; row++)
+    {
+        std::memcpy(&out[row * rowSize], &image[(height - row - 1) * rowSize], rowSize);
+    }
+}
+
+// ADLER32
+
+static unsigned adler32Scalar(unsigned adler, const unsigned char *data, size_t length)
+{
+    unsigned s1 = adler & 0xffffu;
+    unsigned s2 = (adler >> 16u) & 0xffffu;
+    while (length != 0)
+    {
+        const size_t amount = std::min(length, ADLER_BLOCK);
+        length -= amount;
+        for (size_t i = 0; i != amount; ++i)
+        {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+    return (s2 << 16u) | s1;
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static inline unsigned horizontalSumSSE2(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<unsigned>(_mm_cvtsi128_si32(v));
+}
+
+// A block of n bytes adds n * s1 plus (n - i) * byte i to s2, every vector of bytes keeps the sum of the
+// vectors before it and the weighted sum of its own bytes
+SIMD_TARGET("sse2") static unsigned adler32SSE2(unsigned adler, const unsigned char *data, size_t length)
+{
+    unsigned s1 = adler & 0xffffu;
+    unsigned s2 = (adler >> 16u) & 0xffffu;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsFirst = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weightsSecond = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    while (length != 0)
+    {
+        const size_t amount = std::min(length, ADLER_BLOCK);
+        const size_t vectors = amount / 16;
+        length -= amount;
+        __m128i sum = zero;
+        __m128i previous = zero;
+        __m128i weighted = zero;
+        for (size_t v = 0; v < vectors; v++)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+            previous = _mm_add_epi32(previous, sum);
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(bytes, zero));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsFirst));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsSecond));
+            data += 16;
+        }
+        s2 += s1 * static_cast<unsigned>(vectors * 16) + 16 * horizontalSumSSE2(previous) + horizontalSumSSE2(weighted);
+        s1 += horizontalSumSSE2(sum);
+        for (size_t i = vectors * 16; i != amount; ++i)
+        {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+    return (s2 << 16u) | s1;
+}
+
+SIMD_TARGET("avx2") static inline unsigned horizontalSumAVX2(__m256i v)
+{
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return static_cast<unsigned>(_mm_cvtsi128_si32(sum));
+}
+
+SIMD_TARGET("avx2") static unsigned adler32AVX2(unsigned adler, const unsigned char *data, size_t length)
+{
+    unsigned s1 = adler & 0xffffu;
+    unsigned s2 = (adler >> 16u) & 0xffffu;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                             16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    while (length != 0)
+    {
+        const size_t amount = std::min(length, ADLER_BLOCK);
+        const size_t vectors = amount / 32;
+        length -= amount;
+        __m256i sum = zero;
+        __m256i previous = zero;
+        __m256i weighted = zero;
+        for (size_t v = 0; v < vectors; v++)
+        {
+            const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+            previous = _mm256_add_epi32(previous, sum);
+            sum = _mm256_add_epi32(sum, _mm256_sad_epu8(bytes, zero));
+            weighted = _mm256_add_epi32(weighted, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+            data += 32;
+        }
+        s2 += s1 * static_cast<unsigned>(vectors * 32) + 32 * horizontalSumAVX2(previous) + horizontalSumAVX2(weighted);
+        s1 += horizontalSumAVX2(sum);
+        for (size_t i = vectors * 32; i != amount; ++i)
+        {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+    return (s2 << 16u) | s1;
+}
+#endif
+
+unsigned pngAdler32(unsigned adler, const unsigned char *data, size_t length)
+{
+    switch (simdLevel())
+    {
+#ifdef SIMD_X86
+    // the sums of 64 byte vectors would not be faster, the loop is bound by the loads
+    case SimdLevel::AVX512:
+    case SimdLevel::AVX2:
+        return adler32AVX2(adler, data, length);
+    case SimdLevel::SSE2:
+        return adler32SSE2(adler, data, length);
+#endif
+    default:
+        return adler32Scalar(adler, data, length);
+    }
+}
+
+// PNG FILTERS
+
+static unsigned char paethPredictor(short a, short b, short c)
+{
+    short pa = static_cast<short>(std::abs(b - c));
+    short pb = static_cast<short>(std::abs(a - c));
+    const short pc = static_cast<short>(std::abs(a + b - c - c));
+    if (pb < pa)
+    {
+        a = b;
+        pa = pb;
+    }
+    return static_cast<unsigned char>((pc < pa) ? c : a);
+}
+
+// Filters the bytes [begin, length), the vector kernels handle the first bytes and the rest with this
+static void filterScanlineScalar(unsigned char *out, const unsigned char *scanline, const unsigned char *prevline,
+                                 size_t begin, size_t length, size_t bytewidth, unsigned char filterType)
+{
+    size_t i;
+    switch (filterType)
+    {
+    case 0:
+        for (i = begin; i < length; ++i) out[i] = scanline[i];
+        break;
+    case 1:
+        for (i = begin; i < std::min(bytewidth, length); ++i) out[i] = scanline[i];
+        for (i = std::max(begin, bytewidth); i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
+        break;
+    case 2:
+        if (prevline)
+        {
+            for (i = begin; i < length; ++i) out[i] = scanline[i] - prevline[i];
+        }
+        else
+        {
+            for (i = begin; i < length; ++i) out[i] = scanline[i];
+        }
+        break;
+    case 3:
+        if (prevline)
+        {
+            for (i = begin; i < std::min(bytewidth, length); ++i) out[i] = scanline[i] - (prevline[i] >> 1);
+            for (i = std::max(begin, bytewidth); i < length; ++i) out[i] = scanline[i] - ((scanline[i - bytewidth] + prevline[i]) >> 1);
+        }
+        else
+        {
+            for (i = begin; i < std::min(bytewidth, length); ++i) out[i] = scanline[i];
+            for (i = std::max(begin, bytewidth); i < length; ++i) out[i] = scanline[i] - (scanline[i - bytewidth] >> 1);
+        }
+        break;
+    case 4:
+        if (prevline)
+        {
+            for (i = begin; i < std::min(bytewidth, length); ++i) out[i] = scanline[i] - prevline[i];
+            for (i = std::max(begin, bytewidth); i < length; ++i)
+            {
+                out[i] = scanline[i] - paethPredictor(scanline[i - bytewidth], prevline[i], prevline[i - bytewidth]);
+            }
+        }
+        else
+        {
+            for (i = begin; i < std::min(bytewidth, length); ++i) out[i] = scanline[i];
+            for (i = std::max(begin, bytewidth); i < length; ++i) out[i] = scanline[i] - scanline[i - bytewidth];
+        }
+        break;
+    default:
+        return;
+    }
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static inline __m128i load(const unsigned char *p)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+// 8 bytes widened to 16 bits
+SIMD_TARGET("sse2") static inline __m128i loadWide(const unsigned char *p)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+}
+
+// Predictors of 8 bytes widened to 16 bits
+SIMD_TARGET("sse2") static inline __m128i paethSSE2(__m128i a, __m128i b, __m128i c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bc = _mm_sub_epi16(b, c);
+    const __m128i ac = _mm_sub_epi16(a, c);
+    const __m128i abc = _mm_add_epi16(bc, ac);
+    const __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+    const __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+    const __m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+    const __m128i takeB = _mm_cmplt_epi16(pb, pa);
+    const __m128i best = _mm_or_si128(_mm_and_si128(takeB, b), _mm_andnot_si128(takeB, a));
+    const __m128i takeC = _mm_cmplt_epi16(pc, _mm_min_epi16(pa, pb));
+    return _mm_or_si128(_mm_and_si128(takeC, c), _mm_andnot_si128(takeC, best));
+}
+
+SIMD_TARGET("sse2") static void filterScanlineSSE2(unsigned char *out, const unsigned char *scanline, const unsigned char *prevline,
+                                                   size_t length, size_t bytewidth, unsigned char filterType)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBit = _mm_set1_epi8(1);
+    const __m128i lowBits = _mm_set1_epi8(0x7f);
+    // the scalar kernel filters the first pixel, which has no left neighbour, and the remainder
+    size_t i = std::min(bytewidth, length);
+    filterScanlineScalar(out, scanline, prevline, 0, i, bytewidth, filterType);
+    switch (filterType)
+    {
+    case 1:
+        for (; i + 16 <= length; i += 16)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(load(scanline + i), load(scanline + i - bytewidth)));
+        }
+        break;
+    case 2:
+        for (; prevline && i + 16 <= length; i += 16)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(load(scanline + i), load(prevline + i)));
+        }
+        break;
+    case 3:
+        for (; i + 16 <= length; i += 16)
+        {
+            const __m128i left = load(scanline + i - bytewidth);
+            __m128i average;
+            if (prevline)
+            {
+                // the rounding up of pavgb is undone for odd sums
+                const __m128i up = load(prevline + i);
+                average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), lowBit));
+            }
+            else
+            {
+                average = _mm_and_si128(_mm_srli_epi16(left, 1), lowBits);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(load(scanline + i), average));
+        }
+        break;
+    case 4:
+        if (!prevline)
+        {
+            for (; i + 16 <= length; i += 16)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(load(scanline + i), load(scanline + i - bytewidth)));
+            }
+            break;
+        }
+        for (; i + 8 <= length; i += 8)
+        {
+            const __m128i predictor = paethSSE2(loadWide(scanline + i - bytewidth), loadWide(prevline + i), loadWide(prevline + i - bytewidth));
+            const __m128i filtered = _mm_sub_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(scanline + i)), _mm_packus_epi16(predictor, zero));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i), filtered);
+        }
+        break;
+    default:
+        break;
+    }
+    filterScanlineScalar(out, scanline, prevline, i, length, bytewidth, filterType);
+}
+
+SIMD_TARGET("avx2") static inline __m256i paethAVX2(__m256i a, __m256i b, __m256i c)
+{
+    const __m256i bc = _mm256_sub_epi16(b, c);
+    const __m256i ac = _mm256_sub_epi16(a, c);
+    const __m256i pa = _mm256_abs_epi16(bc);
+    const __m256i pb = _mm256_abs_epi16(ac);
+    const __m256i pc = _mm256_abs_epi16(_mm256_add_epi16(bc, ac));
+    const __m256i best = _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi16(pa, pb));
+    return _mm256_blendv_epi8(best, c, _mm256_cmpgt_epi16(_mm256_min_epi16(pa, pb), pc));
+}
+
+SIMD_TARGET("avx2") static void filterScanlineAVX2(unsigned char *out, const unsigned char *scanline, const unsigned char *prevline,
+                                                   size_t length, size_t bytewidth, unsigned char filterType)
+{
+    const __m256i lowBit = _mm256_set1_epi8(1);
+    const __m256i lowBits = _mm256_set1_epi8(0x7f);
+    size_t i = std::min(bytewidth, length);
+    filterScanlineScalar(out, scanline, prevline, 0, i, bytewidth, filterType);
+    switch (filterType)
+    {
+    case 1:
+        for (; i + 32 <= length; i += 32)
+        {
+            const __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i));
+            const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i - bytewidth));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_sub_epi8(current, left));
+        }
+        break;
+    case 2:
+        for (; prevline && i + 32 <= length; i += 32)
+        {
+            const __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i));
+            const __m256i up = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(prevline + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_sub_epi8(current, up));
+        }
+        break;
+    case 3:
+        for (; i + 32 <= length; i += 32)
+        {
+            const __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i));
+            const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i - bytewidth));
+            __m256i average;
+            if (prevline)
+            {
+                const __m256i up = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(prevline + i));
+                average = _mm256_sub_epi8(_mm256_avg_epu8(left, up), _mm256_and_si256(_mm256_xor_si256(left, up), lowBit));
+            }
+            else
+            {
+                average = _mm256_and_si256(_mm256_srli_epi16(left, 1), lowBits);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_sub_epi8(current, average));
+        }
+        break;
+    case 4:
+        if (!prevline)
+        {
+            for (; i + 32 <= length; i += 32)
+            {
+                const __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i));
+                const __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i - bytewidth));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_sub_epi8(current, left));
+            }
+            break;
+        }
+        for (; i + 16 <= length; i += 16)
+        {
+            const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(scanline + i - bytewidth)));
+            const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(prevline + i)));
+            const __m256i c = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(prevline + i - bytewidth)));
+            const __m256i predictor = paethAVX2(a, b, c);
+            const __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(predictor), _mm256_extracti128_si256(predictor, 1));
+            const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scanline + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sub_epi8(current, packed));
+        }
+        break;
+    default:
+        break;
+    }
+    filterScanlineScalar(out, scanline, prevline, i, length, bytewidth, filterType);
+}
+#endif
+
+void pngFilterScanline(unsigned char *out, const unsigned char *scanline, const unsigned char *prevline,
+                       size_t length, size_t bytewidth, unsigned char filterType)
+{
+    switch (simdLevel())
+    {
+#ifdef SIMD_X86
+    // the loads at an offset of bytewidth cost more than wider vectors save
+    case SimdLevel::AVX512:
+    case SimdLevel::AVX2:
+        return filterScanlineAVX2(out, scanline, prevline, length, bytewidth, filterType);
+    case SimdLevel::SSE2:
+        return filterScanlineSSE2(out, scanline, prevline, length, bytewidth, filterType);
+#endif
+    default:
+        return filterScanlineScalar(out, scanline, prevline, 0, length, bytewidth, filterType);
+    }
+}
+
+// FILTER SUMS
+
+static size_t filterSumScalar(const unsigned char *scanline, size_t length, bool differences)
+{
+    size_t sum = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        const unsigned char s = scanline[i];
+        // 255 - s is the magnitude of negative differences
+        sum += !differences || s < 128 ? s : (255u - s);
+    }
+    return sum;
+}
+
+#ifdef SIMD_X86
+SIMD_TARGET("sse2") static size_t filterSumSSE2(const unsigned char *scanline, size_t length, bool differences)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(scanline + i));
+        // 255 - s equals the inverted bits of s
+        if (differences)
+            bytes = _mm_xor_si128(bytes, _mm_cmplt_epi8(bytes, zero));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(bytes, zero));
+    }
+    return static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums))) +
+           filterSumScalar(scanline + i, length - i, differences);
+}
+
+SIMD_TARGET("avx2") static size_t filterSumAVX2(const unsigned char *scanline, size_t length, bool differences)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sums = zero;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(scanline + i));
+        if (differences)
+            bytes = _mm256_xor_si256(bytes, _mm256_cmpgt_epi8(zero, bytes));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(bytes, zero));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sums);
+    return static_cast<size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + filterSumScalar(scanline + i, length - i, differences);
+}
+
+SIMD_TARGET("avx512f,avx512bw") static size_t filterSumAVX512(const unsigned char *scanline, size_t length, bool differences)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i sums = zero;
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64)
+    {
+        __m512i bytes = _mm512_loadu_si512(scanline + i);
+        if (differences)
+            bytes = _mm512_xor_si512(bytes, _mm512_movm_epi8(_mm512_movepi8_mask(bytes)));
+        sums = _mm512_add_epi64(sums, _mm512_sad_epu8(bytes, zero));
+    }
+    return static_cast<size_t>(_mm512_reduce_add_epi64(sums)) + filterSumScalar(scanline + i, length - i, differences);
+}
+#endif
+
+size_t pngFilterSum(const unsigned char *scanline, size_t length, bool differences)
+{
+    switch (simdLevel())
+    {
+#ifdef SIMD_X86
+    case SimdLevel::AVX512:
+        return filterSumAVX512(scanline, length, differences);
+    case SimdLevel::AVX2:
+        return filterSumAVX2(scanline, length, differences);
+    case SimdLevel::SSE2:
+        return filterSumSSE2(scanline, length, differences);
+#endif
+    default:
+        return filterSumScalar(scanline, length, differences);
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Instruction sets the CPU kernels below are compiled for. The highest level the CPU supports is used,
+// the environment variable SPLAT_RENDERER_SIMD=scalar|sse2|avx2|avx512 selects a lower one for benchmarks.
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+SimdLevel simdLevel();
+std::string simdLevelName(SimdLevel level);
+// Throws for unknown names
+SimdLevel parseSimdLevel(const std::string &name);
+// Levels the CPU does not support fall back to the highest supported one, returns the level in use
+SimdLevel setSimdLevel(SimdLevel level);
+
+// out[i] = (float)in[i], used for point clouds stored with double precision
+void convertDoubles(const double *in, float *out, size_t count);
+
+// Converts the window depths of an image that starts with the bottom row to 16 bit big endian values of
+// the linear depth times depthScale, starting with the top row. Pixels at depth 0 or 1 become 0.
+void packDepth(const float *depth, unsigned char *out, int width, int height, float near, float far, float depthScale);
+// Copies the rows of an image in reverse order
+void flipRows(const unsigned char *image, unsigned char *out, size_t rowSize, int height);
+
+// PNG encoding kernels of lodepng, they produce exactly the same output as the scalar code of lodepng
+unsigned pngAdler32(unsigned adler, const unsigned char *data, size_t length);
+void pngFilterScanline(unsigned char *out, const unsigned char *scanline, const unsigned char *prevline,
+                       size_t length, size_t bytewidth, unsigned char filterType);
+// Sum of the bytes of a filtered scanline, differences count as signed bytes
+size_t pngFilterSum(const unsigned char *scanline, size_t length, bool differences);
@@ -0,0 +1,107 @@
+#include "stagetimes.h"
+
+#include <fstream>
+#include <stdexcept>
+
+std::string stageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::ContextCreation:
+        return "contextCreation";
+    case Stage::PlyLoad:
+        return "plyLoad";
+    case Stage::SceneBuild:
+        return "sceneBuild";
+    case Stage::TrajectoryLoad:
+        return "trajectoryLoad";
+    case Stage::GpuUpload:
+        return "gpuUpload";
+    case Stage::ShaderCompile:
+        return "shaderCompile";
+    case Stage::Setup:
+        return "setup";
+    case Stage::Render:
+        return "render";
+    case Stage::ReadbackWait:
+        return "readbackWait";
+    case Stage::WriterWait:
+        return "writerWait";
+    case Stage::Conversion:
+        return "conversion";
+    case Stage::Encode:
+        return "encode";
+    case Stage::FileWrite:
+        return "fileWrite";
+    default:
+        return "unknown";
+    }
+}
+
+StageTimes::StageTimes()
+{
+    for (auto &stage : nanoseconds)
+    {
+        stage = 0;
+    }
+    framesStart = framesStop = std::chrono::steady_clock::now();
+}
+
+void StageTimes::add(Stage stage, double seconds)
+{
+    nanoseconds[static_cast<size_t>(stage)] += static_cast<uint64_t>(seconds * 1e9);
+}
+
+double StageTimes::seconds(Stage stage) const
+{
+    return nanoseconds[static_cast<size_t>(stage)] * 1e-9;
+}
+
+void StageTimes::startFrames()
+{
+    framesStart = framesStop = std::chrono::steady_clock::now();
+}
+
+void StageTimes::stopFrames()
+{
+    framesStop = std::chrono::steady_clock::now();
+}
+
+double StageTimes::framesSeconds() const
+{
+    return std::chrono::duration<double>(framesStop - framesStart).count();
+}
+
+double StageTimes::framesPerSecond() const
+{
+    const double seconds = framesSeconds();
+    return seconds > 0.0 ? frameSeconds.size() / seconds : 0.0;
+}
+
+double StageTimes::bytesPerSecond() const
+{
+    const double seconds = framesSeconds();
+    return seconds > 0.0 ? written / seconds : 0.0;
+}
+
+void StageTimes::writeJson(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not write " + path);
+    }
+    file << "{\n  \"stages\": {";
+    for (size_t s = 0; s < NUM_STAGES; s++)
+    {
+        file << (s > 0 ? "," : "") << "\n    \"" << stageName(static_cast<Stage>(s)) << "\": " << seconds(static_cast<Stage>(s));
+    }
+    file << "\n  },\n  \"frameSeconds\": [";
+    for (size_t f = 0; f < frameSeconds.size(); f++)
+    {
+        file << (f > 0 ? ", " : "") << frameSeconds[f];
+    }
+    file << "],\n  \"frames\": " << frameSeconds.size() << ",\n  \"seconds\": " << framesSeconds()
+         << ",\n  \"framesPerSecond\": " << framesPerSecond() << ",\n  \"bytesWritten\": " << written
+         << ",\n  \"bytesPerSecond\": " << bytesPerSecond() << "\n}\n";
+}
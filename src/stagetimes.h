@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Stages of a call to render, the ones after Render run once per frame
+enum class Stage
+{
+    ContextCreation,
+    PlyLoad,
+    SceneBuild,  // chunks, Morton order and levels of detail
+    TrajectoryLoad,
+    GpuUpload,
+    ShaderCompile,
+    Setup,  // everything before the first frame, the stages above overlap within it
+    Render,
+    ReadbackWait,  // mapping the pixel buffer objects and copying the pixels
+    WriterWait,  // waiting for a frame that is still being written
+    Conversion,  // flipping the images and packing the depth
+    Encode,
+    FileWrite,
+    Count
+};
+
+const size_t NUM_STAGES = static_cast<size_t>(Stage::Count);
+
+std::string stageName(Stage stage);
+
+// Time spent in every stage of one call to render. Stages that run on several threads at once, like
+// encoding, add up the time of all threads. Can be updated from any thread.
+class StageTimes
+{
+public:
+    StageTimes();
+
+    void add(Stage stage, double seconds);
+    double seconds(Stage stage) const;
+
+    // Render time of every frame, also added to the render stage. Only called by the rendering thread.
+    void addFrame(double seconds)
+    {
+        frameSeconds.push_back(seconds);
+        add(Stage::Render, seconds);
+    }
+    const std::vector<double> &frames() const { return frameSeconds; }
+
+    void addBytesWritten(size_t bytes) { written += bytes; }
+    uint64_t bytesWritten() const { return written; }
+
+    // Marks the span the frames are rendered and written in, which the rates are based on
+    void startFrames();
+    void stopFrames();
+    double framesSeconds() const;
+    double framesPerSecond() const;
+    double bytesPerSecond() const;
+
+    void writeJson(const std::string &path) const;
+
+private:
+    std::array<std::atomic<uint64_t>, NUM_STAGES> nanoseconds;
+    std::vector<double> frameSeconds;
+    std::atomic<uint64_t> written{0};
+    std::chrono::steady_clock::time_point framesStart, framesStop;
+};
+
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Adds the time until it is destroyed to a stage
+class StageTimer
+{
+public:
+    StageTimer(StageTimes &times, Stage stage) : times(times), stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { times.add(stage, secondsSince(start)); }
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    StageTimes &times;
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+};
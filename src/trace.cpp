@@ -0,0 +1,113 @@
+#include "trace.h"
+
+#ifdef SPLAT_RENDERER_TRACING
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Zones per thread, the oldest ones are overwritten once a buffer is full
+const size_t TRACE_BUFFER_SIZE = size_t(1) << 16;
+
+namespace
+{
+struct Event
+{
+    const char *name;
+    int64_t start;  // nanoseconds
+    int64_t end;
+};
+
+struct ThreadBuffer
+{
+    std::vector<Event> events;
+    size_t count = 0;  // recorded since the start, may exceed the size of the buffer
+    uint32_t id;
+};
+
+const auto epoch = std::chrono::steady_clock::now();
+
+// Buffers of all threads that recorded zones, they outlive their threads until they are written
+std::mutex buffersMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+uint32_t mainThread = 0;  // the thread that started tracing
+
+ThreadBuffer &threadBuffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer)
+    {
+        buffer = std::make_shared<ThreadBuffer>();
+        buffer->events.resize(TRACE_BUFFER_SIZE);
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        buffer->id = static_cast<uint32_t>(buffers.size());
+        buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+}
+
+namespace trace_detail
+{
+std::atomic<bool> enabled{false};
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(const char *name, int64_t start, int64_t end)
+{
+    auto &buffer = threadBuffer();
+    buffer.events[buffer.count % TRACE_BUFFER_SIZE] = {name, start, end};
+    buffer.count++;
+}
+}
+
+void startTracing()
+{
+    mainThread = threadBuffer().id;
+    {
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for (auto &buffer : buffers)
+        {
+            buffer->count = 0;
+        }
+    }
+    trace_detail::enabled = true;
+}
+
+void writeTrace(const std::string &path)
+{
+    trace_detail::enabled = false;
+    std::ofstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not write " + path);
+    }
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    for (const auto &buffer : buffers)
+    {
+        const size_t count = std::min(buffer->count, TRACE_BUFFER_SIZE);
+        for (size_t e = buffer->count - count; e < buffer->count; e++)
+        {
+            const auto &event = buffer->events[e % TRACE_BUFFER_SIZE];
+            // complete events with microseconds
+            file << (first ? "" : ",") << "\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+                 << buffer->id << ", \"ts\": " << event.start / 1000 << "." << event.start % 1000 / 100
+                 << ", \"dur\": " << (event.end - event.start) / 1000 << "." << (event.end - event.start) % 1000 / 100 << "}";
+            first = false;
+        }
+        file << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+             << ", \"args\": {\"name\": \"" << (buffer->id == mainThread ? std::string("main") : "thread " + std::to_string(buffer->id)) << "\"}}";
+        first = false;
+    }
+    file << "\n]}\n";
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+// Timeline of the render pipeline in the Chrome trace event format, which chrome://tracing and
+// https://ui.perfetto.dev display. Zones are only recorded if the module is configured with
+// SPLAT_RENDERER_TRACING=ON, otherwise TRACE_ZONE compiles to nothing.
+
+#ifdef SPLAT_RENDERER_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Drops the zones recorded so far and records the following ones
+void startTracing();
+// Stops recording and writes the recorded zones of all threads as JSON
+void writeTrace(const std::string &path);
+
+namespace trace_detail
+{
+extern std::atomic<bool> enabled;
+int64_t now();
+void record(const char *name, int64_t start, int64_t end);
+}
+
+// Records the time between its construction and destruction on the calling thread. name has to be a
+// string literal, only the pointer is stored.
+class TraceZone
+{
+public:
+    explicit TraceZone(const char *name) : name(name), start(trace_detail::enabled.load(std::memory_order_relaxed) ? trace_detail::now() : -1) {}
+    ~TraceZone()
+    {
+        if (start >= 0)
+            trace_detail::record(name, start, trace_detail::now());
+    }
+    TraceZone(const TraceZone &) = delete;
+    TraceZone &operator=(const TraceZone &) = delete;
+
+private:
+    const char *name;
+    int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+
+#else
+
+#define TRACE_ZONE(name) ((void)0)
+
+#endif
@@ -0,0 +1,152 @@
+#include "upload.h"
+#include "memorystats.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <stdexcept>
+
+// Waiting for a copy out of a staging buffer is retried after this many nanoseconds
+const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+StagingUpload::StagingUpload(size_t batchBytes, size_t numStagingBuffers)
+    : batchBytes(batchBytes), stagings(numStagingBuffers)
+{
+}
+
+void StagingUpload::createStagings()
+{
+    // small uploads do not need full batches
+    size_t largest = 0;
+    for (const auto &array : arrays)
+    {
+        largest = std::max(largest, array.numBytes);
+    }
+    if (largest == 0)
+        return;
+    batchBytes = std::min(batchBytes, largest);
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    for (auto &staging : stagings)
+    {
+        glGenBuffers(1, &staging.buffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+        glBufferStorage(GL_COPY_READ_BUFFER, batchBytes, nullptr, flags);
+        staging.memory = static_cast<unsigned char *>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, batchBytes, flags));
+        if (!staging.memory)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            throw std::runtime_error("Could not map a staging buffer for the upload");
+        }
+        MemoryStats::instance().add(MemoryCategory::GpuVertexBuffers, batchBytes);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+StagingUpload::~StagingUpload()
+{
+    for (auto &staging : stagings)
+    {
+        if (!staging.buffer)
+            continue;
+        waitForCopy(staging);
+        if (staging.memory)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            MemoryStats::instance().remove(MemoryCategory::GpuVertexBuffers, batchBytes);
+        }
+        glDeleteBuffers(1, &staging.buffer);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+GLuint StagingUpload::add(const void *data, size_t numBytes, size_t size, std::function<void()> uploaded)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    // only ever written by the GPU itself
+    glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    MemoryStats::instance().add(MemoryCategory::GpuVertexBuffers, size);
+    arrays.push_back({buffer, static_cast<const unsigned char *>(data), std::min(numBytes, size), std::move(uploaded)});
+    return buffer;
+}
+
+void StagingUpload::waitForCopy(Staging &staging)
+{
+    if (!staging.fence)
+        return;
+    TRACE_ZONE("wait for staging buffer");
+    GLenum status;
+    do
+    {
+        status = glClientWaitSync(staging.fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    } while (status == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(staging.fence);
+    staging.fence = nullptr;
+}
+
+void StagingUpload::finish()
+{
+    struct Batch
+    {
+        size_t array;
+        size_t offset;
+        size_t bytes;
+        Staging *staging;
+        std::future<void> filled;
+    };
+
+    if (!stagings.front().buffer)
+        createStagings();
+    auto &pool = ThreadPool::instance();
+    std::deque<Batch> batches;
+    // copies the oldest batch into place once a worker has filled its staging buffer
+    auto copyOldest = [&]() {
+        auto &batch = batches.front();
+        pool.wait(batch.filled);
+        const auto &array = arrays[batch.array];
+        glBindBuffer(GL_COPY_READ_BUFFER, batch.staging->buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, array.buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, batch.offset, batch.bytes);
+        batch.staging->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (batch.offset + batch.bytes == array.numBytes && array.uploaded)
+            array.uploaded();
+        batches.pop_front();
+    };
+
+    size_t next = 0;
+    for (size_t a = 0; a < arrays.size(); a++)
+    {
+        if (arrays[a].numBytes == 0 && arrays[a].uploaded)
+            arrays[a].uploaded();
+        for (size_t offset = 0; offset < arrays[a].numBytes; offset += batchBytes)
+        {
+            if (batches.size() == stagings.size())
+                copyOldest();
+            auto &staging = stagings[next];
+            next = (next + 1) % stagings.size();
+            waitForCopy(staging);
+
+            const size_t bytes = std::min(batchBytes, arrays[a].numBytes - offset);
+            const unsigned char *source = arrays[a].data + offset;
+            unsigned char *target = staging.memory;
+            batches.push_back({a, offset, bytes, &staging, pool.submit([source, target, bytes]() {
+                                   TRACE_ZONE("fill staging buffer");
+                                   std::memcpy(target, source, bytes);
+                               })});
+        }
+    }
+    while (!batches.empty())
+    {
+        copyOldest();
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    arrays.clear();
+}
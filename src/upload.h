@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <glad/glad.h>
+
+// Uploads arrays into immutable buffers through a ring of persistently mapped staging buffers. Worker
+// threads copy the arrays batch by batch into the staging buffers, while the GL thread copies every filled
+// staging buffer into its final buffer with glCopyBufferSubData, so the copies on the CPU and the transfers
+// to the GPU overlap. Only the thread the context is current on may use it.
+class StagingUpload
+{
+public:
+    StagingUpload(size_t batchBytes, size_t numStagingBuffers);
+    ~StagingUpload();
+    StagingUpload(const StagingUpload &) = delete;
+    StagingUpload &operator=(const StagingUpload &) = delete;
+
+    // Creates an immutable buffer of size bytes, whose first numBytes bytes are copied from data by finish.
+    // data has to stay valid until then, uploaded is called right after its last batch was copied.
+    GLuint add(const void *data, size_t numBytes, size_t size, std::function<void()> uploaded = nullptr);
+    // Uploads all added arrays, the staging buffers are allocated by the first call
+    void finish();
+
+private:
+    struct Staging
+    {
+        GLuint buffer = 0;
+        unsigned char *memory = nullptr;
+        GLsync fence = nullptr;  // set while the GPU still copies out of it
+    };
+
+    struct Array
+    {
+        GLuint buffer;
+        const unsigned char *data;
+        size_t numBytes;
+        std::function<void()> uploaded;
+    };
+
+    void createStagings();
+    void waitForCopy(Staging &staging);
+
+    size_t batchBytes;
+    std::vector<Staging> stagings;
+    std::vector<Array> arrays;
+};
@@ -0,0 +1,107 @@
+import argparse
+import csv
+import multiprocessing
+import os
+import resource
+import sys
+
+from synthetic import SCENES, point_size, scene_files
+
+# Throughput of all methods on synthetic scenes of growing size. Every configuration runs in a fresh process,
+# so its peak memory is not hidden by an earlier one, and OpenGL runs on Mesa's software rasterizer llvmpipe,
+# so machines with and without a GPU produce comparable numbers.
+SIZES = [10 ** 5, 10 ** 6, 10 ** 7, 10 ** 8]
+METHODS = ["standard", "ewa", "compute", "cpu", "cpu_ewa", "raycast"]
+RESOLUTIONS = ["640x480", "1280x720"]
+SOFTWARE_GL = {"LIBGL_ALWAYS_SOFTWARE": "1", "GALLIUM_DRIVER": "llvmpipe"}
+
+COLUMNS = ["scene", "splats", "method", "width", "height", "frames", "ply_mb", "load_mb_per_s", "fps",
+           "render_ms_per_frame", "readback_ms_per_frame", "encode_mb_per_s", "write_mb_per_s", "output_mb_per_s",
+           "peak_rss_mb", "error"]
+
+
+def run(config):
+    # imported here, the module has to be loaded after the environment selected the GL driver
+    from splat_renderer import render
+
+    width, height = config["width"], config["height"]
+    timing = render(config["ply"], config["trajectory"], config["output"], method=config["method"], width=width,
+                    height=height, fx=0.825 * width, fy=0.825 * width, cx=width / 2.0, cy=height / 2.0,
+                    pointSize=config["pointSize"], surfaceThickness=0.1)
+    stages = timing["stages"]
+    frames = max(timing["frames"], 1)
+    ply_mb = os.path.getsize(config["ply"]) * 1e-6
+    # raw color and 16 bit depth of all frames
+    image_mb = frames * width * height * 5 * 1e-6
+
+    def rate(amount, seconds):
+        return amount / seconds if seconds > 0.0 else 0.0
+
+    return {
+        "frames": timing["frames"],
+        "ply_mb": ply_mb,
+        "load_mb_per_s": rate(ply_mb, stages["plyLoad"]),
+        "fps": timing["framesPerSecond"],
+        "render_ms_per_frame": 1000.0 * stages["render"] / frames,
+        "readback_ms_per_frame": 1000.0 * stages["readbackWait"] / frames,
+        # per thread, encoding runs on all cores at once
+        "encode_mb_per_s": rate(image_mb, stages["encode"]),
+        "write_mb_per_s": rate(timing["bytesWritten"] * 1e-6, stages["fileWrite"]),
+        "output_mb_per_s": timing["bytesPerSecond"] * 1e-6,
+        # kilobytes on Linux
+        "peak_rss_mb": resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024.0,
+    }
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Measures the throughput of all methods on synthetic scenes")
+    parser.add_argument("--scenes", nargs="+", default=SCENES, choices=SCENES)
+    parser.add_argument("--sizes", nargs="+", type=int, default=SIZES, help="numbers of splats")
+    parser.add_argument("--methods", nargs="+", default=METHODS)
+    parser.add_argument("--resolutions", nargs="+", default=RESOLUTIONS, help="WIDTHxHEIGHT")
+    parser.add_argument("--frames", type=int, default=10)
+    parser.add_argument("--data", default="../benchmark", help="directory of the scenes and the rendered frames")
+    parser.add_argument("--results", default="../benchmark/results.csv")
+    parser.add_argument("--hardware", action="store_true", help="use the GPU instead of llvmpipe")
+    args = parser.parse_args()
+
+    if not args.hardware:
+        os.environ.update(SOFTWARE_GL)
+    # fresh processes that do not inherit the memory of this one
+    context = multiprocessing.get_context("spawn")
+
+    os.makedirs(os.path.dirname(os.path.abspath(args.results)), exist_ok=True)
+    failures = []
+    with open(args.results, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=COLUMNS)
+        writer.writeheader()
+        for scene in args.scenes:
+            for size in args.sizes:
+                ply, trajectory = scene_files(os.path.join(args.data, "scenes"), scene, size, args.frames)
+                for resolution in args.resolutions:
+                    width, height = (int(v) for v in resolution.split("x"))
+                    for method in args.methods:
+                        config = {"ply": ply, "trajectory": trajectory, "method": method, "width": width, "height": height,
+                                  "pointSize": point_size(scene, size),
+                                  "output": os.path.join(args.data, "output", "{}_{}_{}_{}".format(scene, size, method, resolution))}
+                        row = {"scene": scene, "splats": size, "method": method, "width": width, "height": height}
+                        try:
+                            with context.Pool(1) as pool:
+                                result = pool.apply(run, (config,))
+                        except Exception as e:
+                            # failed configurations stay in the results, with empty measurements
+                            failures.append("{} {} {} {}".format(scene, size, method, resolution))
+                            row["error"] = str(e)
+                            writer.writerow(row)
+                            f.flush()
+                            print("{} {} {} {}: {}".format(scene, size, method, resolution, e))
+                            continue
+                        result.update(row)
+                        writer.writerow(result)
+                        f.flush()
+                        print("{} {:>9} {:>8} {}: {:7.2f} fps, {:8.1f} MB/s load, {:7.1f} MB peak".format(
+                            scene, size, method, resolution, result["fps"], result["load_mb_per_s"], result["peak_rss_mb"]))
+
+    if failures:
+        print("{} configurations failed: {}".format(len(failures), ", ".join(failures)))
+        sys.exit(1)
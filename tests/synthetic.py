@@ -0,0 +1,158 @@
+import math
+import os
+
+import numpy as np
+
+# Deterministic synthetic surfel scenes and matching camera trajectories. The same scene, number of splats
+# and seed always produce the same file, independent of the machine.
+SCENES = ["room", "planes", "spheres"]
+
+# points are generated in blocks with their own seeds, so large scenes never have to fit into memory
+BLOCK_SIZE = 1 << 20
+
+VERTEX = np.dtype([("x", "<f4"), ("y", "<f4"), ("z", "<f4"), ("nx", "<f4"), ("ny", "<f4"), ("nz", "<f4"),
+                   ("red", "u1"), ("green", "u1"), ("blue", "u1")])
+# the same with double precision positions and normals, as some scanners write them
+VERTEX_DOUBLE = np.dtype([("x", "<f8"), ("y", "<f8"), ("z", "<f8"), ("nx", "<f8"), ("ny", "<f8"), ("nz", "<f8"),
+                          ("red", "u1"), ("green", "u1"), ("blue", "u1")])
+
+# walls of a 4 x 3 x 4 m box seen from the inside: (normal axis, sign of the normal, offset along the axis)
+ROOM_SIZE = (4.0, 3.0, 4.0)
+ROOM_WALLS = [(0, 1.0, -2.0), (0, -1.0, 2.0), (1, 1.0, -1.5), (1, -1.0, 1.5), (2, 1.0, -2.0), (2, -1.0, 2.0)]
+# planes of 4 x 3 m facing the camera every 0.5 m, most splats are hidden behind the first one
+NUM_PLANES = 8
+PLANE_SPACING = 0.5
+# a grid of 4 x 4 spheres with a radius of 0.4 m
+SPHERE_GRID = 4
+SPHERE_RADIUS = 0.4
+SPHERE_SPACING = 1.0
+
+
+def surface_area(scene):
+    if scene == "room":
+        w, h, d = ROOM_SIZE
+        return 2.0 * (w * h + w * d + h * d)
+    if scene == "planes":
+        return NUM_PLANES * 4.0 * 3.0
+    if scene == "spheres":
+        return SPHERE_GRID * SPHERE_GRID * 4.0 * math.pi * SPHERE_RADIUS ** 2
+    raise ValueError("Unknown scene " + scene)
+
+
+def point_size(scene, num_splats):
+    """Radius of the splats that closes the surfaces of the scene without holes"""
+    return 1.5 * math.sqrt(surface_area(scene) / (math.pi * num_splats))
+
+
+def _block(scene, rng, count, vertex):
+    positions = np.empty((count, 3), dtype=np.float64)
+    normals = np.zeros((count, 3), dtype=np.float64)
+    colors = np.empty((count, 3), dtype=np.uint8)
+    if scene == "room":
+        areas = np.array([ROOM_SIZE[(axis + 1) % 3] * ROOM_SIZE[(axis + 2) % 3] for axis, _, _ in ROOM_WALLS])
+        walls = rng.choice(len(ROOM_WALLS), size=count, p=areas / areas.sum())
+        uv = rng.random((count, 3))
+        positions[:] = (uv - 0.5) * np.array(ROOM_SIZE)
+        for w, (axis, sign, offset) in enumerate(ROOM_WALLS):
+            selected = walls == w
+            positions[selected, axis] = offset
+            normals[selected, axis] = sign
+        # a checkerboard of 0.5 m tiles
+        tiles = np.floor(positions / 0.5).astype(np.int64).sum(axis=1) & 1
+        colors[:, 0] = 40 * walls + 30
+        colors[:, 1] = 80 + 120 * tiles
+        colors[:, 2] = 128
+    elif scene == "planes":
+        planes = rng.integers(0, NUM_PLANES, size=count)
+        positions[:, 0] = (rng.random(count) - 0.5) * 4.0
+        positions[:, 1] = (rng.random(count) - 0.5) * 3.0
+        positions[:, 2] = -1.0 - PLANE_SPACING * planes
+        normals[:, 2] = 1.0
+        colors[:, 0] = 255 - 25 * planes
+        colors[:, 1] = 30 * planes
+        colors[:, 2] = (128 + 127 * np.sin(4.0 * positions[:, 0])).astype(np.uint8)
+    elif scene == "spheres":
+        spheres = rng.integers(0, SPHERE_GRID * SPHERE_GRID, size=count)
+        directions = rng.standard_normal((count, 3))
+        directions /= np.linalg.norm(directions, axis=1, keepdims=True)
+        centers = np.stack([(spheres % SPHERE_GRID - (SPHERE_GRID - 1) / 2.0) * SPHERE_SPACING,
+                            np.zeros(count),
+                            (spheres // SPHERE_GRID - (SPHERE_GRID - 1) / 2.0) * SPHERE_SPACING], axis=1)
+        positions[:] = centers + SPHERE_RADIUS * directions
+        normals[:] = directions
+        colors[:] = (127.5 * (directions + 1.0)).astype(np.uint8)
+    else:
+        raise ValueError("Unknown scene " + scene)
+
+    vertices = np.empty(count, dtype=vertex)
+    for i, name in enumerate(["x", "y", "z"]):
+        vertices[name] = positions[:, i]
+    for i, name in enumerate(["nx", "ny", "nz"]):
+        vertices[name] = normals[:, i]
+    for i, name in enumerate(["red", "green", "blue"]):
+        vertices[name] = colors[:, i]
+    return vertices
+
+
+def write_scene(path, scene, num_splats, seed=0, double=False):
+    """Writes a binary PLY file with positions, normals and colors of num_splats points. With double the
+    positions and normals are stored as doubles, which round to exactly the floats of the float file."""
+    vertex = VERTEX_DOUBLE if double else VERTEX
+    types = {"f4": "float", "f8": "double", "u1": "uchar"}
+    with open(path, "wb") as f:
+        header = ["ply", "format binary_little_endian 1.0", "comment synthetic {} scene, seed {}".format(scene, seed),
+                  "element vertex {}".format(num_splats)]
+        header += ["property {} {}".format(types[vertex[name].str[1:]], name) for name in vertex.names]
+        header += ["end_header"]
+        f.write(("\n".join(header) + "\n").encode("ascii"))
+        for block, first in enumerate(range(0, num_splats, BLOCK_SIZE)):
+            rng = np.random.default_rng([seed, block])
+            _block(scene, rng, min(BLOCK_SIZE, num_splats - first), vertex).tofile(f)
+
+
+def camera_poses(scene, num_frames):
+    """Camera to world transformations, the cameras look along their negative z axis"""
+    poses = []
+    for k in range(num_frames):
+        t = k / num_frames
+        if scene == "room":
+            # turns around once in the middle of the room
+            angle = 2.0 * math.pi * t
+            position = (0.3 * math.sin(angle), 0.1, 0.3 * math.cos(angle))
+        elif scene == "planes":
+            # sways in front of the planes
+            angle = 0.4 * math.sin(2.0 * math.pi * t)
+            position = (math.sin(angle), 0.0, 1.0 + math.cos(angle))
+        elif scene == "spheres":
+            # circles the grid of spheres
+            angle = 2.0 * math.pi * t
+            position = (4.0 * math.sin(angle), 0.0, 4.0 * math.cos(angle))
+        else:
+            raise ValueError("Unknown scene " + scene)
+        c, s = math.cos(angle), math.sin(angle)
+        pose = np.eye(4)
+        pose[:3, :3] = [[c, 0.0, s], [0.0, 1.0, 0.0], [-s, 0.0, c]]
+        pose[:3, 3] = position
+        poses.append(pose)
+    return poses
+
+
+def write_trajectory(path, scene, num_frames):
+    """Writes the camera poses as consecutive 4 x 4 matrices"""
+    rows = [" ".join("{:f}".format(v) for v in row) for pose in camera_poses(scene, num_frames) for row in pose]
+    # a line break after the last matrix would be read as another pose
+    with open(path, "w") as f:
+        f.write("\n".join(rows))
+
+
+def scene_files(directory, scene, num_splats, num_frames, seed=0, double=False):
+    """Generates the scene and its trajectory unless they exist, returns both paths"""
+    os.makedirs(directory, exist_ok=True)
+    ply = os.path.join(directory, "{}_{}_{}{}.ply".format(scene, num_splats, seed, "_double" if double else ""))
+    trajectory = os.path.join(directory, "{}_{}.txt".format(scene, num_frames))
+    if not os.path.exists(ply):
+        write_scene(ply + ".tmp", scene, num_splats, seed, double)
+        os.replace(ply + ".tmp", ply)
+    if not os.path.exists(trajectory):
+        write_trajectory(trajectory, scene, num_frames)
+    return ply, trajectory
@@ -0,0 +1,39 @@
+import os
+
+import numpy as np
+from PIL import Image
+
+from splat_renderer import render
+from synthetic import point_size, scene_files
+
+# Renders the same frames with the GL methods and their CPU counterparts and compares the images.
+# Only pixels at the silhouettes of the splats may differ, the GPU draws polygons instead of exact discs.
+MAX_DIFFERENT_PIXELS = 0.01
+METHODS = [("standard", "cpu"), ("ewa", "cpu_ewa")]
+SCENE = "room"
+NUM_SPLATS = 20000
+NUM_FRAMES = 3
+WIDTH, HEIGHT = 160, 120
+OUTPUT_DIR = "../output/cpu"
+
+if __name__ == '__main__':
+    try:
+        ply, trajectory = scene_files(os.path.join(OUTPUT_DIR, "scenes"), SCENE, NUM_SPLATS, NUM_FRAMES)
+        for gl_method, cpu_method in METHODS:
+            for method in [gl_method, cpu_method]:
+                render(ply, trajectory, os.path.join(OUTPUT_DIR, method), method=method, width=WIDTH, height=HEIGHT,
+                       fx=0.825 * WIDTH, fy=0.825 * WIDTH, cx=WIDTH / 2.0, cy=HEIGHT / 2.0,
+                       pointSize=point_size(SCENE, NUM_SPLATS), surfaceThickness=0.1)
+
+            for kind in ["debug", "depth"]:
+                for name in sorted(os.listdir(os.path.join(OUTPUT_DIR, gl_method, kind))):
+                    gl = np.asarray(Image.open(os.path.join(OUTPUT_DIR, gl_method, kind, name)), dtype=np.int64)
+                    cpu = np.asarray(Image.open(os.path.join(OUTPUT_DIR, cpu_method, kind, name)), dtype=np.int64)
+                    # depth is stored in mm, allow for the rounding of the 24 bit depth buffer
+                    tolerance = 2 if kind == "depth" else 1
+                    different = np.mean(np.abs(gl - cpu) > tolerance)
+                    print("{} {}/{}: {:.4%} of the pixels differ".format(cpu_method, kind, name, different))
+                    assert different <= MAX_DIFFERENT_PIXELS
+    except Exception as e:
+        print(e)
+        raise
@@ -0,0 +1,144 @@
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+import numpy as np
+from PIL import Image
+
+from synthetic import point_size, scene_files
+
+# Renders small synthetic scenes with every method on Mesa's software rasterizer llvmpipe and compares the
+# color and depth images with the golden ones in tests/golden, which were rendered the same way. Small
+# differences between Mesa versions stay within the tolerances below. The frames also have to be rendered
+# within the frame times of the baseline run that recorded the golden images, times BUDGET_SLACK. Frame
+# times depend on the machine, record a new baseline with --update after checking the images by eye. The scenes
+# are stored next to the golden images, as NumPy does not promise the same random numbers in every version.
+# --update only generates the missing ones with synthetic.py, delete them to record a changed generator.
+SCENES = {"room": 20000, "planes": 20000, "spheres": 20000}
+METHODS = ["standard", "ewa", "compute", "cpu", "cpu_ewa", "raycast"]
+NUM_FRAMES = 3
+WIDTH, HEIGHT = 160, 120
+SOFTWARE_GL = {"LIBGL_ALWAYS_SOFTWARE": "1", "GALLIUM_DRIVER": "llvmpipe"}
+
+GOLDEN_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "golden")
+BASELINE = os.path.join(GOLDEN_DIR, "baseline.json")
+OUTPUT_DIR = "../output/golden"
+
+# A pixel differs if a color channel differs by more than COLOR_TOLERANCE, if the depths differ by more than
+# DEPTH_TOLERANCE millimeters or if only one of the images covers it
+COLOR_TOLERANCE = 16
+DEPTH_TOLERANCE = 10
+MAX_DIFFERENT_PIXELS = 0.01
+BUDGET_SLACK = 2.0
+
+
+def read_png(path, kind):
+    """Color images as RGB and depth images as 16 bit millimeters, lodepng stores them with fewer bits or a
+    palette wherever that loses nothing"""
+    image = Image.open(path)
+    if kind == "depth" and image.mode.startswith("I"):
+        return np.asarray(image, dtype=np.int64)
+    if kind == "depth":
+        return np.asarray(image.convert("L"), dtype=np.int64) * 257
+    return np.asarray(image.convert("RGB"), dtype=np.int64)
+
+
+def different_pixels(kind, image, golden):
+    """Fraction of the pixels that differ more than the tolerance"""
+    if image.shape != golden.shape:
+        return 1.0
+    if kind == "depth":
+        different = ((image > 0) != (golden > 0)) | (np.abs(image - golden) > DEPTH_TOLERANCE)
+    else:
+        different = np.any(np.abs(image - golden) > COLOR_TOLERANCE, axis=2)
+    return float(np.mean(different))
+
+
+def compare(output, golden):
+    """Returns a description of every frame that differs from the golden one"""
+    failures = []
+    for kind in ["debug", "depth"]:
+        names = sorted(os.listdir(os.path.join(golden, kind)))
+        if sorted(os.listdir(os.path.join(output, kind))) != names:
+            failures.append("{}: rendered other frames than {}".format(kind, names))
+            continue
+        for name in names:
+            fraction = different_pixels(kind, read_png(os.path.join(output, kind, name), kind),
+                                        read_png(os.path.join(golden, kind, name), kind))
+            if fraction > MAX_DIFFERENT_PIXELS:
+                failures.append("{}/{}: {:.2%} of the pixels differ".format(kind, name, fraction))
+    return failures
+
+
+def headless():
+    """Runs the test again in a virtual X server if there is no display"""
+    if not sys.platform.startswith("linux") or os.environ.get("DISPLAY") or os.environ.get("WAYLAND_DISPLAY"):
+        return
+    if not shutil.which("xvfb-run"):
+        raise RuntimeError("No display, install xvfb-run or run the test in a virtual X server")
+    sys.exit(subprocess.call(["xvfb-run", "-a", sys.executable] + sys.argv))
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description="Compares all methods with golden images and frame time budgets")
+    parser.add_argument("--update", action="store_true", help="record new golden images and frame times")
+    parser.add_argument("--slack", type=float, default=BUDGET_SLACK, help="allowed factor over the baseline frame times")
+    parser.add_argument("--no-budgets", action="store_true", help="only compare the images")
+    args = parser.parse_args()
+
+    headless()
+    os.environ.update(SOFTWARE_GL)
+    # imported here, the module has to be loaded after the environment selected the GL driver
+    from splat_renderer import render
+
+    baseline = {"frameMilliseconds": {}}
+    if not args.update:
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+
+    failures = []
+    for scene, num_splats in SCENES.items():
+        ply = os.path.join(GOLDEN_DIR, scene, "scene.ply")
+        trajectory = os.path.join(GOLDEN_DIR, scene, "trajectory.txt")
+        if args.update and not os.path.exists(ply):
+            generated = scene_files(os.path.join(OUTPUT_DIR, "scenes"), scene, num_splats, NUM_FRAMES)
+            os.makedirs(os.path.join(GOLDEN_DIR, scene), exist_ok=True)
+            shutil.copyfile(generated[0], ply)
+            shutil.copyfile(generated[1], trajectory)
+
+        for method in METHODS:
+            key = "{}/{}".format(scene, method)
+            output = os.path.join(OUTPUT_DIR, scene, method)
+            golden = os.path.join(GOLDEN_DIR, scene, method)
+            shutil.rmtree(output, ignore_errors=True)
+            timing = render(ply, trajectory, output, method=method, width=WIDTH, height=HEIGHT, fx=0.825 * WIDTH,
+                            fy=0.825 * WIDTH, cx=WIDTH / 2.0, cy=HEIGHT / 2.0, pointSize=point_size(scene, num_splats),
+                            surfaceThickness=0.1)
+            # the fastest frame, the first ones also compile the shaders of llvmpipe
+            milliseconds = 1000.0 * min(timing["frameSeconds"])
+
+            if args.update:
+                shutil.rmtree(golden, ignore_errors=True)
+                for kind in ["debug", "depth"]:
+                    shutil.copytree(os.path.join(output, kind), os.path.join(golden, kind))
+                baseline["frameMilliseconds"][key] = round(milliseconds, 3)
+                print("{:16} {:8.2f} ms per frame".format(key, milliseconds))
+                continue
+
+            errors = compare(output, golden)
+            budget = args.slack * baseline["frameMilliseconds"][key]
+            if not args.no_budgets and milliseconds > budget:
+                errors.append("{:.2f} ms per frame, the budget is {:.2f} ms".format(milliseconds, budget))
+            failures += ["{}: {}".format(key, e) for e in errors]
+            print("{:16} {:8.2f} ms per frame {}".format(key, milliseconds, "FAILED" if errors else "ok"))
+
+    if args.update:
+        with open(BASELINE, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+    for failure in failures:
+        print(failure)
+    assert not failures
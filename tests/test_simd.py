@@ -0,0 +1,53 @@
+import filecmp
+import os
+
+from splat_renderer import render, setSimdLevel
+from synthetic import point_size, scene_files
+
+# Renders the same frames with the scalar CPU kernels and every instruction set the CPU supports. Converting
+# double precision PLY files, depth packing, image flipping and PNG encoding have to produce exactly the same
+# files on every level. The double precision scene rounds to the float one, so both render the same images.
+LEVELS = ["scalar", "sse2", "avx2", "avx512"]
+SCENE = "room"
+NUM_SPLATS = 20000
+NUM_FRAMES = 3
+WIDTH, HEIGHT = 160, 120
+OUTPUT_DIR = "../output/simd"
+
+
+def different_files(first, second):
+    """Number of files that differ between two runs, missing ones included, and the number of files compared"""
+    different, count = 0, 0
+    for kind in ["debug", "depth"]:
+        names = sorted(os.listdir(os.path.join(first, kind)))
+        _, mismatch, errors = filecmp.cmpfiles(os.path.join(first, kind), os.path.join(second, kind), names,
+                                               shallow=False)
+        different += len(mismatch) + len(errors)
+        count += len(names)
+    return different, count
+
+
+if __name__ == '__main__':
+    scenes = {}
+    for precision, double in [("float", False), ("double", True)]:
+        scenes[precision], trajectory = scene_files(os.path.join(OUTPUT_DIR, "scenes"), SCENE, NUM_SPLATS, NUM_FRAMES,
+                                                    double=double)
+
+    failures = []
+    for level in LEVELS:
+        if setSimdLevel(level) != level:
+            print("{} is not supported by this CPU".format(level))
+            continue
+        for precision, ply in scenes.items():
+            output = os.path.join(OUTPUT_DIR, "{}_{}".format(level, precision))
+            render(ply, trajectory, output, method="cpu", width=WIDTH, height=HEIGHT, fx=0.825 * WIDTH,
+                   fy=0.825 * WIDTH, cx=WIDTH / 2.0, cy=HEIGHT / 2.0, pointSize=point_size(SCENE, NUM_SPLATS))
+
+            reference = os.path.join(OUTPUT_DIR, "scalar_float")
+            if output == reference:
+                continue
+            different, count = different_files(reference, output)
+            print("{} {}: {} of {} files differ".format(level, precision, different, count))
+            if different:
+                failures.append("{} {}".format(level, precision))
+    assert not failures, failures